@@ -0,0 +1,287 @@
+/**
+ * @file   batch.c
+ *
+ * @brief  Batch mode: encode, repair or verify many objects in one run
+ *         The prefixes of the objects are read one per line from a
+ *         manifest and handed out to a pool of worker processes, forked
+ *         once the field tables and the encoding matrix are set up. The
+ *         coding functions exit on errors, so an object failing only takes
+ *         its worker down: the failure is reported and the worker replaced
+ *         while the other objects go on.
+ */
+
+#include "ec.h"
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+typedef struct s_worker
+{
+  pid_t pid;
+  int req_fd;       /* prefixes to the worker, one per line */
+  int rep_fd;       /* one status byte back per prefix */
+  char *prefix;     /* object in progress, NULL if idle */
+} t_worker;
+
+/*
+ * manifest reader on the bare fd: a stdio stream would be flushed by the
+ * workers exiting, which may seek the offset they share with the parent
+ */
+typedef struct s_lines
+{
+  int fd;
+  char buf[4096];
+  size_t start;     /* first byte not handed out yet */
+  size_t end;       /* end of the bytes read */
+  char *line;
+  size_t size;
+} t_lines;
+
+/*
+ * next non-empty line, without its newline, or NULL at the end
+ */
+static char *next_line(t_lines *lr)
+{
+  size_t len = 0;
+  char *nl;
+  ssize_t ret;
+
+  while (1) {
+    if (lr->start == lr->end) {
+      do {
+        ret = read(lr->fd, lr->buf, sizeof (lr->buf));
+      } while (-1 == ret && EINTR == errno);
+      if (-1 == ret)
+        xperror("read");
+      lr->start = 0;
+      lr->end = ret;
+      if (0 == ret) {
+        if (0 == len)
+          return NULL;
+        lr->line[len] = 0;
+        return lr->line;
+      }
+    }
+    nl = memchr(lr->buf + lr->start, '\n', lr->end - lr->start);
+    ret = (NULL == nl) ? lr->end - lr->start : nl - (lr->buf + lr->start);
+    if (len + ret + 2 > lr->size) {
+      lr->size = 2 * (len + ret + 2);
+      if (NULL == (lr->line = realloc(lr->line, lr->size)))
+        xperror("malloc");
+    }
+    memcpy(lr->line + len, lr->buf + lr->start, ret);
+    len += ret;
+    lr->start += ret;
+    if (NULL != nl) {
+      lr->start++;
+      if (len > 0) {
+        lr->line[len] = 0;
+        return lr->line;
+      }
+    }
+  }
+}
+
+/**
+ * encode, repair or verify one object, exiting on the errors the coding
+ * functions exit on
+ *
+ * @param op EC_BATCH_ENCODE, EC_BATCH_REPAIR or EC_BATCH_VERIFY
+ * @param mat encoding matrix
+ * @param prefix prefix of the files of the object
+ *
+ * @return 0 on success, -1 if the repair or the verification failed
+ */
+int batch_object(int op, t_mat *mat, char *prefix)
+{
+  switch (op) {
+  case EC_BATCH_ENCODE:
+    create_coding_files(prefix, mat);
+    return 0;
+  case EC_BATCH_REPAIR:
+    return repair_data_files(prefix, mat);
+  default:
+    return verify_coding_files(prefix, mat);
+  }
+}
+
+/*
+ * worker process: run op on every prefix received until the parent
+ * closes the request pipe
+ */
+static void worker_loop(int op, t_mat *mat, int req_fd, int rep_fd)
+{
+  FILE *req;
+  char *line = NULL;
+  size_t size = 0;
+  ssize_t len;
+  u_char status;
+
+  if (NULL == (req = fdopen(req_fd, "r")))
+    xperror("fdopen");
+  while (-1 != (len = getline(&line, &size, req))) {
+    if (len > 0 && '\n' == line[len - 1])
+      line[len - 1] = 0;
+    status = (0 == batch_object(op, mat, line)) ? 0 : 1;
+    if (1 != write(rep_fd, &status, 1))
+      xperror("write");
+  }
+  exit(0);
+}
+
+/*
+ * fork worker w, the fds of the other workers being closed in the child
+ * so that they see the end of their requests when the parent is done
+ */
+static void worker_spawn(t_worker *workers, int n, int w, int op, t_mat *mat,
+                         int lr_fd)
+{
+  int req[2], rep[2];
+  int i;
+
+  if (-1 == pipe(req) || -1 == pipe(rep))
+    xperror("pipe");
+  fflush(NULL);
+  switch (workers[w].pid = fork()) {
+  case -1:
+    xperror("fork");
+  case 0:
+    close(req[1]);
+    close(rep[0]);
+    for (i = 0;i < n;i++) {
+      if (i != w && -1 != workers[i].req_fd) {
+        close(workers[i].req_fd);
+        close(workers[i].rep_fd);
+      }
+    }
+    if (0 != lr_fd)
+      close(lr_fd);
+    worker_loop(op, mat, req[0], rep[1]);
+  }
+  close(req[0]);
+  close(rep[1]);
+  workers[w].req_fd = req[1];
+  workers[w].rep_fd = rep[0];
+  workers[w].prefix = NULL;
+}
+
+/*
+ * report the end of the object of worker w
+ */
+static void worker_done(t_worker *w, int ok, int *n_failed)
+{
+  if (!ok) {
+    fprintf(stderr, "%s: failed\n", w->prefix);
+    (*n_failed)++;
+  } else if (vflag) {
+    fprintf(stderr, "%s: ok\n", w->prefix);
+  }
+  free(w->prefix);
+  w->prefix = NULL;
+}
+
+/**
+ * encode, repair or verify every object of a manifest on n_threads
+ * worker processes, each object being processed on a single thread
+ *
+ * @param op EC_BATCH_ENCODE, EC_BATCH_REPAIR or EC_BATCH_VERIFY
+ * @param mat encoding matrix
+ * @param manifest file listing the prefixes of the objects, one per
+ *   line, or "-" for stdin
+ *
+ * @return 0 if every object succeeded, -1 otherwise
+ */
+int batch(int op, t_mat *mat, char *manifest)
+{
+  int n = n_threads;
+  t_worker workers[n];
+  struct pollfd pfds[n];
+  int map[n];
+  t_lines lr;
+  char *line;
+  size_t len;
+  u_char status;
+  int i, n_busy, n_polled, n_failed = 0;
+  int eof = 0;
+  int ret;
+
+  memset(&lr, 0, sizeof (lr));
+  if (0 == strcmp(manifest, "-"))
+    lr.fd = 0;
+  else if (-1 == (lr.fd = open(manifest, O_RDONLY)))
+    xerrormsg("error opening", manifest);
+
+  //a worker dying must not kill the batch through a request
+  signal(SIGPIPE, SIG_IGN);
+  n_threads = 1;
+  for (i = 0;i < n;i++)
+    workers[i].req_fd = -1;
+  for (i = 0;i < n;i++)
+    worker_spawn(workers, n, i, op, mat, lr.fd);
+
+  n_busy = 0;
+  while (1) {
+    //hand out the next objects to the idle workers
+    for (i = 0;i < n && !eof;i++) {
+      if (NULL != workers[i].prefix)
+        continue ;
+      if (NULL == (line = next_line(&lr))) {
+        eof = 1;
+        break ;
+      }
+      workers[i].prefix = xstrdup(line);
+      len = strlen(line);
+      line[len] = '\n';
+      if (len + 1 != write(workers[i].req_fd, line, len + 1))
+        xperror("write");
+      n_busy++;
+    }
+    if (0 == n_busy)
+      break ;
+
+    n_polled = 0;
+    for (i = 0;i < n;i++) {
+      if (NULL != workers[i].prefix) {
+        pfds[n_polled].fd = workers[i].rep_fd;
+        pfds[n_polled].events = POLLIN;
+        map[n_polled++] = i;
+      }
+    }
+    if (-1 == poll(pfds, n_polled, -1)) {
+      if (EINTR == errno)
+        continue ;
+      xperror("poll");
+    }
+    for (i = 0;i < n_polled;i++) {
+      t_worker *w = &workers[map[i]];
+
+      if (0 == pfds[i].revents)
+        continue ;
+      n_busy--;
+      if (1 == read(w->rep_fd, &status, 1)) {
+        worker_done(w, 0 == status, &n_failed);
+        continue ;
+      }
+      //the worker exited on an error, replace it
+      worker_done(w, 0, &n_failed);
+      close(w->req_fd);
+      close(w->rep_fd);
+      waitpid(w->pid, NULL, 0);
+      worker_spawn(workers, n, map[i], op, mat, lr.fd);
+    }
+  }
+
+  for (i = 0;i < n;i++)
+    close(workers[i].req_fd);
+  ret = (0 == n_failed) ? 0 : -1;
+  for (i = 0;i < n;i++) {
+    close(workers[i].rep_fd);
+    waitpid(workers[i].pid, NULL, 0);
+  }
+  if (n_failed > 0)
+    fprintf(stderr, "%d object(s) failed\n", n_failed);
+  free(lr.line);
+  if (0 != lr.fd)
+    close(lr.fd);
+  return ret;
+}
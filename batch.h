@@ -0,0 +1,7 @@
+/* operations of the batch mode */
+#define EC_BATCH_ENCODE 0
+#define EC_BATCH_REPAIR 1
+#define EC_BATCH_VERIFY 2
+
+extern int batch_object(int op, t_mat *mat, char *prefix);
+extern int batch(int op, t_mat *mat, char *manifest);
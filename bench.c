@@ -0,0 +1,245 @@
+/**
+ * @file   bench.c
+ * 
+ * @brief  Throughput benchmark of the codec library
+ *         Measures encode, single-erasure and multi-erasure decode over a
+ *         grid of matrix types, (k, m), buffer sizes and thread counts,
+ *         and prints one CSV line per measurement.
+ */
+
+#include "ec.h"
+#include <time.h>
+
+#define MAX_LIST 32     /* max values per grid axis */
+
+typedef struct s_job
+{
+  t_ec_ctx *ctx;
+  int op;
+  u_int n_data;
+  u_int n_coding;
+  u_char **frags;           /* n_data + n_coding regions */
+  int *erasures;
+  int n_erasures;
+  size_t off;               /* slice handled by this thread */
+  size_t len;
+  u_long iters;
+} t_job;
+
+enum { OP_ENCODE, OP_DECODE1, OP_DECODEM };
+static char *op_names[] = { "encode", "decode1", "decodem" };
+
+static double min_time = 0.2;
+
+static double now()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *run_job(void *arg)
+{
+  t_job *job = arg;
+  u_char *slice[job->n_data + job->n_coding];
+  u_long i;
+  int ret;
+
+  for (i = 0;i < job->n_data + job->n_coding;i++)
+    slice[i] = job->frags[i] + job->off;
+  for (i = 0;i < job->iters;i++) {
+    if (OP_ENCODE == job->op)
+      ret = ec_encode(job->ctx, slice, slice + job->n_data, job->len);
+    else
+      ret = ec_decode(job->ctx, slice, job->erasures, job->n_erasures,
+                      job->len);
+    if (EC_OK != ret) {
+      fprintf(stderr, "%s: %s\n", op_names[job->op], ec_strerror(ret));
+      exit(1);
+    }
+  }
+  return NULL;
+}
+
+/*
+ * run iters iterations of op on n_threads threads, each on its own slice
+ * of the regions, and return the elapsed time
+ */
+static double run(t_job *proto, int n_threads, size_t size, u_long iters)
+{
+  t_job jobs[n_threads];
+  pthread_t threads[n_threads];
+  size_t slice = alignw(size / n_threads);
+  double start;
+  int t;
+
+  start = now();
+  for (t = 0;t < n_threads;t++) {
+    jobs[t] = *proto;
+    jobs[t].off = t * slice;
+    jobs[t].len = (t == n_threads - 1) ? size - t * slice : slice;
+    jobs[t].iters = iters;
+    if (1 == n_threads)
+      run_job(&jobs[t]);
+    else if (0 != (errno = pthread_create(&threads[t], NULL, run_job, &jobs[t])))
+      xperror("pthread_create");
+  }
+  if (n_threads > 1)
+    for (t = 0;t < n_threads;t++)
+      pthread_join(threads[t], NULL);
+  return now() - start;
+}
+
+/*
+ * find an iteration count lasting at least min_time, then report
+ */
+static void measure(t_job *proto, char *mat_name, size_t size, int n_threads)
+{
+  u_long iters = 1;
+  double elapsed;
+
+  //warm up the buffers
+  run(proto, n_threads, size, 1);
+  while ((elapsed = run(proto, n_threads, size, iters)) < min_time)
+    iters = (elapsed < min_time / 100) ? iters * 10 : iters * 2;
+  printf("%d,%s,%u,%u,%zu,%d,%s,%d,%lu,%.6f,%.3f\n",
+         get_w(), mat_name, proto->n_data, proto->n_coding, size, n_threads,
+         op_names[proto->op], proto->n_erasures,
+         iters, elapsed, (double) proto->n_data * size * iters / elapsed / 1e9);
+  fflush(stdout);
+}
+
+static void bench(int mat_type, u_int k, u_int m, size_t size, int n_threads)
+{
+  char *mat_names[] = { "vandermonde", "cauchy", "cauchy-xor" };
+  char *mat_name = mat_names[mat_type];
+  u_char *frags[k + m];
+  int erasures[m];
+  t_ec_ctx *ctx;
+  t_job job;
+  u_int i;
+  size_t j;
+  int ret;
+
+  if (EC_OK != (ret = ec_ctx_create(&ctx, k, m, mat_type))) {
+    fprintf(stderr, "k=%u m=%u: %s\n", k, m, ec_strerror(ret));
+    return ;
+  }
+  for (i = 0;i < k + m;i++) {
+    frags[i] = xmalloc(size);
+    for (j = 0;j < size;j++)
+      frags[i][j] = rand();
+  }
+
+  job.ctx = ctx;
+  job.n_data = k;
+  job.n_coding = m;
+  job.frags = frags;
+  job.erasures = erasures;
+
+  job.op = OP_ENCODE;
+  job.n_erasures = 0;
+  measure(&job, mat_name, size, n_threads);
+
+  //single data erasure, then as many data erasures as possible
+  job.op = OP_DECODE1;
+  job.n_erasures = 1;
+  erasures[0] = 0;
+  measure(&job, mat_name, size, n_threads);
+
+  job.op = OP_DECODEM;
+  job.n_erasures = (m < k) ? m : k;
+  for (i = 0;i < job.n_erasures;i++)
+    erasures[i] = i;
+  if (job.n_erasures > 1)
+    measure(&job, mat_name, size, n_threads);
+
+  for (i = 0;i < k + m;i++)
+    free(frags[i]);
+  ec_ctx_destroy(ctx);
+}
+
+/*
+ * parse a comma separated list of numbers with optional k/m suffixes
+ */
+static int parse_list(char *str, size_t *list)
+{
+  char *p;
+  int n = 0;
+
+  for (p = strtok(str, ",");p != NULL && n < MAX_LIST;p = strtok(NULL, ",")) {
+    list[n] = strtoul(p, &p, 10);
+    if ('k' == *p || 'K' == *p)
+      list[n] <<= 10;
+    else if ('m' == *p || 'M' == *p)
+      list[n] <<= 20;
+    n++;
+  }
+  return n;
+}
+
+void xusage()
+{
+  fprintf(stderr,
+          "Usage: ecbench [-k n_data,...][-m n_coding,...][-b size,...][-j n_threads,...][-t min_seconds][-s (cauchy only)][-V (vandermonde only)][-X (cauchy bit-matrix only)]\n");
+  exit(1);
+}
+
+int main(int argc, char **argv)
+{
+  size_t ks[MAX_LIST] = { 4, 6, 10, 12 };
+  size_t ms[MAX_LIST] = { 2, 3, 4 };
+  size_t sizes[MAX_LIST] = { 4 << 10, 64 << 10, 1 << 20, 16 << 20, 64 << 20 };
+  size_t threads[MAX_LIST] = { 1, 2, 4 };
+  int n_ks = 4, n_ms = 3, n_sizes = 5, n_threads = 3;
+  int types[3] = { EC_MAT_VANDERMONDE, EC_MAT_CAUCHY, EC_MAT_CAUCHY_XOR };
+  int n_types = 3;
+  int opt, t, a, b, s, j;
+
+  while ((opt = getopt(argc, argv, "k:m:b:j:t:sVX")) != -1) {
+    switch (opt) {
+    case 'k':
+      n_ks = parse_list(optarg, ks);
+      break ;
+    case 'm':
+      n_ms = parse_list(optarg, ms);
+      break ;
+    case 'b':
+      n_sizes = parse_list(optarg, sizes);
+      break ;
+    case 'j':
+      n_threads = parse_list(optarg, threads);
+      break ;
+    case 't':
+      min_time = atof(optarg);
+      break ;
+    case 's':
+      types[0] = EC_MAT_CAUCHY;
+      n_types = 1;
+      break ;
+    case 'V':
+      types[0] = EC_MAT_VANDERMONDE;
+      n_types = 1;
+      break ;
+    case 'X':
+      types[0] = EC_MAT_CAUCHY_XOR;
+      n_types = 1;
+      break ;
+    default:
+      xusage();
+    }
+  }
+
+  printf("w,matrix,k,m,size,threads,op,erasures,iterations,seconds,gbps\n");
+  for (t = 0;t < n_types;t++)
+    for (a = 0;a < n_ks;a++)
+      for (b = 0;b < n_ms;b++)
+        for (s = 0;s < n_sizes;s++)
+          for (j = 0;j < n_threads;j++) {
+            if (0 == threads[j] || alignw(sizes[s]) != sizes[s])
+              xusage();
+            bench(types[t], ks[a], ms[b], sizes[s], threads[j]);
+          }
+  return 0;
+}
@@ -0,0 +1,297 @@
+/**
+ * @file   bitmat.c
+ *
+ * @brief  Bit-matrix coding
+ *         Every element e of a GF(2^w) matrix is expanded into the w x w
+ *         binary matrix of the multiplication by e, whose column c holds
+ *         the bits of e * 2^c. Regions are cut into chunks of w packets,
+ *         packet b of a chunk carrying bit b of its words, so that the
+ *         product is computed with XORs of whole packets only. The XORs
+ *         follow a schedule where an output packet is derived from an
+ *         output packet already computed when they differ by fewer input
+ *         packets than it has. Bytes past the last whole chunk are
+ *         multiplied in the field.
+ */
+
+#include "ec.h"
+#if defined(__x86_64__) || defined(__i386__)
+# include <immintrin.h>
+# define HAVE_X86_SIMD
+#endif
+
+#define XOP_ZERO 0
+#define XOP_COPY 1
+#define XOP_XOR  2
+
+/*
+ * number of input packets that differ between output packets r1 and r2,
+ * or the weight of r1 if r2 is -1
+ */
+static int bitmat_distance(t_bitmat *bm, int r1, int r2)
+{
+  int j, n = 0;
+
+  for (j = 0;j < bm->n_cols;j++) {
+    if (BITMAT_ITEM(bm, r1, j) != ((-1 == r2) ? 0 : BITMAT_ITEM(bm, r2, j)))
+      n++;
+  }
+  return n;
+}
+
+static void bitmat_schedule(t_bitmat *bm)
+{
+  t_xop *op = bm->ops;
+  int r, p, j, best, cost, d, first;
+
+  for (r = 0;r < bm->n_rows;r++) {
+    //from scratch: a copy then an XOR per other input packet
+    best = -1;
+    cost = bitmat_distance(bm, r, -1);
+    for (p = 0;p < r;p++) {
+      d = bitmat_distance(bm, r, p) + 1;
+      if (d < cost) {
+        cost = d;
+        best = p;
+      }
+    }
+    if (-1 != best) {
+      op->op = XOP_COPY;
+      op->dst = r;
+      op->src = best;
+      op->from_out = 1;
+      op++;
+    } else if (0 == cost) {
+      op->op = XOP_ZERO;
+      op->dst = r;
+      op->src = 0;
+      op->from_out = 0;
+      op++;
+    }
+    //the first packet of a row built from scratch is copied
+    first = (-1 == best);
+    for (j = 0;j < bm->n_cols;j++) {
+      if (BITMAT_ITEM(bm, r, j) == ((-1 == best) ? 0 : BITMAT_ITEM(bm, best, j)))
+        continue ;
+      op->op = first ? XOP_COPY : XOP_XOR;
+      first = 0;
+      op->dst = r;
+      op->src = j;
+      op->from_out = 0;
+      op++;
+    }
+  }
+  bm->n_ops = op - bm->ops;
+}
+
+static void packet_xor_words(u_char *dst, u_char *src)
+{
+  u_int64_t *d = (u_int64_t *) dst;
+  u_int64_t *s = (u_int64_t *) src;
+  int i;
+
+  for (i = 0;i < EC_PACKET_SIZE / sizeof (u_int64_t);i++)
+    d[i] ^= s[i];
+}
+
+#ifdef HAVE_X86_SIMD
+__attribute__((target("sse2")))
+static void packet_xor_sse2(u_char *dst, u_char *src)
+{
+  __m128i *d = (__m128i *) dst;
+  __m128i *s = (__m128i *) src;
+  int i;
+
+  for (i = 0;i < EC_PACKET_SIZE / sizeof (__m128i);i += 4) {
+    _mm_storeu_si128(d + i, _mm_xor_si128(_mm_loadu_si128(d + i), _mm_loadu_si128(s + i)));
+    _mm_storeu_si128(d + i + 1, _mm_xor_si128(_mm_loadu_si128(d + i + 1), _mm_loadu_si128(s + i + 1)));
+    _mm_storeu_si128(d + i + 2, _mm_xor_si128(_mm_loadu_si128(d + i + 2), _mm_loadu_si128(s + i + 2)));
+    _mm_storeu_si128(d + i + 3, _mm_xor_si128(_mm_loadu_si128(d + i + 3), _mm_loadu_si128(s + i + 3)));
+  }
+}
+
+__attribute__((target("avx2")))
+static void packet_xor_avx2(u_char *dst, u_char *src)
+{
+  __m256i *d = (__m256i *) dst;
+  __m256i *s = (__m256i *) src;
+  int i;
+
+  for (i = 0;i < EC_PACKET_SIZE / sizeof (__m256i);i += 4) {
+    _mm256_storeu_si256(d + i, _mm256_xor_si256(_mm256_loadu_si256(d + i), _mm256_loadu_si256(s + i)));
+    _mm256_storeu_si256(d + i + 1, _mm256_xor_si256(_mm256_loadu_si256(d + i + 1), _mm256_loadu_si256(s + i + 1)));
+    _mm256_storeu_si256(d + i + 2, _mm256_xor_si256(_mm256_loadu_si256(d + i + 2), _mm256_loadu_si256(s + i + 2)));
+    _mm256_storeu_si256(d + i + 3, _mm256_xor_si256(_mm256_loadu_si256(d + i + 3), _mm256_loadu_si256(s + i + 3)));
+  }
+}
+#endif
+
+/*
+ * number of ones in the bit-matrix of e
+ */
+static int bitmat_ones(int e)
+{
+  int c, n = 0;
+
+  for (c = 0;c < get_w();c++)
+    n += __builtin_popcount(gmul(e, 1 << c));
+  return n;
+}
+
+/**
+ * divide each row of an encoding matrix by the element of the row that
+ * leaves the fewest ones in its bit-matrix, hence the fewest XORs.
+ * Scaling a coding row scales the determinant of every square submatrix
+ * it is part of, so the code stays MDS.
+ *
+ * @param mat encoding matrix, modified in place
+ */
+void bitmat_improve(t_mat *mat)
+{
+  int i, j, k, n, best, best_n;
+
+  for (i = 0;i < mat->n_rows;i++) {
+    best = 1;
+    best_n = -1;
+    for (k = 0;k < mat->n_cols;k++) {
+      if (0 == MAT_ITEM(mat, i, k))
+        continue ;
+      n = 0;
+      for (j = 0;j < mat->n_cols;j++)
+        n += bitmat_ones(gdiv(MAT_ITEM(mat, i, j), MAT_ITEM(mat, i, k)));
+      if (-1 == best_n || n < best_n) {
+        best_n = n;
+        best = MAT_ITEM(mat, i, k);
+      }
+    }
+    for (j = 0;j < mat->n_cols;j++)
+      MAT_ITEM(mat, i, j) = gdiv(MAT_ITEM(mat, i, j), best);
+  }
+}
+
+/**
+ * expand a matrix into its bit-matrix and schedule its XORs
+ *
+ * @param mat GF matrix, must outlive the bit-matrix
+ *
+ * @return the bit-matrix, or NULL if out of memory
+ */
+t_bitmat *bitmat_create(t_mat *mat)
+{
+  t_bitmat *bm;
+  int w = get_w();
+  int i, j, r, c, e;
+
+  if (NULL == (bm = calloc(1, sizeof (*bm))))
+    return NULL;
+  bm->mat = mat;
+  bm->w = w;
+  bm->n_rows = mat->n_rows * w;
+  bm->n_cols = mat->n_cols * w;
+  bm->bits = calloc(1, bm->n_rows * bm->n_cols + 1);
+  //worst case: every row built from scratch, or zeroed
+  bm->ops = malloc(sizeof (t_xop) * bm->n_rows * (bm->n_cols + 1));
+  if (NULL == bm->bits || NULL == bm->ops) {
+    bitmat_free(bm);
+    return NULL;
+  }
+
+  for (i = 0;i < mat->n_rows;i++) {
+    for (j = 0;j < mat->n_cols;j++) {
+      for (c = 0;c < w;c++) {
+        e = gmul(MAT_ITEM(mat, i, j), 1 << c);
+        for (r = 0;r < w;r++)
+          BITMAT_ITEM(bm, i * w + r, j * w + c) = (e >> r) & 1;
+      }
+    }
+  }
+  bitmat_schedule(bm);
+
+  bm->xor_fn = packet_xor_words;
+#ifdef HAVE_X86_SIMD
+  if (__builtin_cpu_supports("avx2"))
+    bm->xor_fn = packet_xor_avx2;
+  else if (__builtin_cpu_supports("sse2"))
+    bm->xor_fn = packet_xor_sse2;
+#endif
+  return bm;
+}
+
+void bitmat_free(t_bitmat *bm)
+{
+  if (bm) {
+    free(bm->bits);
+    free(bm->ops);
+    free(bm);
+  }
+}
+
+/**
+ * @return the number of packet XORs per chunk
+ */
+int bitmat_n_xors(t_bitmat *bm)
+{
+  int i, n = 0;
+
+  for (i = 0;i < bm->n_ops;i++) {
+    if (XOP_XOR == bm->ops[i].op)
+      n++;
+  }
+  return n;
+}
+
+/**
+ * out = bm * in, like mat_mult_region on the underlying matrix but with
+ * the bit-sliced layout on whole chunks
+ *
+ * @param bm bit-matrix
+ * @param in n_cols input regions
+ * @param out n_rows output regions, NULL for the outputs not wanted
+ * @param len length of every region in bytes, a multiple of the word size
+ * @param scratch BITMAT_SCRATCH_SIZE(bm) bytes in which the chunks of the
+ *   outputs not wanted are computed, the schedule reading them back; may
+ *   be NULL if every output is wanted
+ */
+void bitmat_mult_region(t_bitmat *bm, u_char **in, u_char **out, size_t len,
+                        u_char *scratch)
+{
+  size_t chunk = bm->w * EC_PACKET_SIZE;
+  size_t off, tail;
+  u_char *in_tail[bm->mat->n_cols];
+  u_char *out_tail[bm->mat->n_rows];
+  u_char *o[bm->mat->n_rows];
+  u_char *dst, *src;
+  t_xop *op;
+  int i;
+
+  //the schedule reads back outputs, the missing ones go to scratch chunks
+  tail = len % chunk;
+  for (off = 0;off < len - tail;off += chunk) {
+    for (i = 0;i < bm->mat->n_rows;i++) {
+      assert(NULL != out[i] || NULL != scratch);
+      o[i] = (NULL != out[i]) ? out[i] + off : scratch + i * chunk;
+    }
+    for (op = bm->ops;op < bm->ops + bm->n_ops;op++) {
+      dst = o[op->dst / bm->w] + (op->dst % bm->w) * EC_PACKET_SIZE;
+      src = (op->from_out ? o[op->src / bm->w] : in[op->src / bm->w] + off) +
+        (op->src % bm->w) * EC_PACKET_SIZE;
+      switch (op->op) {
+      case XOP_ZERO:
+        memset(dst, 0, EC_PACKET_SIZE);
+        break ;
+      case XOP_COPY:
+        memcpy(dst, src, EC_PACKET_SIZE);
+        break ;
+      default:
+        bm->xor_fn(dst, src);
+      }
+    }
+  }
+
+  if (tail > 0) {
+    for (i = 0;i < bm->mat->n_cols;i++)
+      in_tail[i] = in[i] + len - tail;
+    for (i = 0;i < bm->mat->n_rows;i++)
+      out_tail[i] = (NULL == out[i]) ? NULL : out[i] + len - tail;
+    mat_mult_region(bm->mat, in_tail, out_tail, tail);
+  }
+}
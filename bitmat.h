@@ -0,0 +1,37 @@
+/* bytes of a packet: a region is cut into chunks of w packets */
+#define EC_PACKET_SIZE 2048
+
+/*
+ * one step of an XOR schedule, packets are numbered row * w + bit
+ */
+typedef struct s_xop
+{
+  int op;           /* XOP_ZERO, XOP_COPY or XOP_XOR */
+  int dst;          /* output packet */
+  int src;          /* input packet, or output packet if from_out */
+  int from_out;
+} t_xop;
+
+typedef struct s_bitmat
+{
+  t_mat *mat;       /* GF matrix, applied to the tails */
+  int w;
+  u_int n_rows;     /* mat->n_rows * w */
+  u_int n_cols;     /* mat->n_cols * w */
+  u_char *bits;
+  int n_ops;
+  t_xop *ops;
+  void (*xor_fn)(u_char *dst, u_char *src);   /* packet XOR kernel */
+#define BITMAT_ITEM(bm, i, j) ((bm)->bits[(i) * (bm)->n_cols + (j)])
+} t_bitmat;
+
+/* scratch bytes bitmat_mult_region needs when some outputs are not wanted */
+#define BITMAT_SCRATCH_SIZE(bm) \
+  ((size_t) (bm)->mat->n_rows * (bm)->w * EC_PACKET_SIZE)
+
+extern void bitmat_improve(t_mat *mat);
+extern t_bitmat *bitmat_create(t_mat *mat);
+extern void bitmat_free(t_bitmat *bm);
+extern int bitmat_n_xors(t_bitmat *bm);
+extern void bitmat_mult_region(t_bitmat *bm, u_char **in, u_char **out,
+                               size_t len, u_char *scratch);
@@ -0,0 +1,165 @@
+/**
+ * @file   chain.c
+ *
+ * @brief  Pipelined repair: instead of one repairer reading the k
+ *         fragments it decodes from, the lost fragments are rebuilt slice
+ *         by slice along a chain of helper processes, one per fragment
+ *         read, standing in for the nodes holding them. Helper i reads its
+ *         slice, multiplies it by its column of the repair matrix, adds it
+ *         to the partial results received from helper i - 1 and forwards
+ *         them over a Unix socket. The repairer only receives the finished
+ *         slices from the last helper, so the traffic of every link is
+ *         that of the lost fragments and not k times as much.
+ */
+
+#define _GNU_SOURCE     /* O_DIRECT */
+#include "ec.h"
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+/* bytes of every fragment per step down the chain, dividing EC_BLOCK_SIZE */
+#define CHAIN_SLICE (64 * 1024)
+
+/*
+ * helper j: add column j of rep times the slices of fd to the partials
+ * read from prev (none for the first helper) and send them to next
+ */
+static void chain_helper(t_mat *rep, int j, int fd, int prev, int next,
+                         size_t size)
+{
+  t_gf_tables t[rep->n_rows];
+  u_char *dst[MAT_MULTI_MAX];
+  u_char *slice, *partial;
+  struct iovec iov;
+  size_t off, len;
+  int i, g, n;
+
+  for (i = 0;i < rep->n_rows;i++)
+    gf_tables_init(&t[i], MAT_ITEM(rep, i, j));
+  slice = xmalloc(CHAIN_SLICE);
+  partial = xmalloc(rep->n_rows * CHAIN_SLICE);
+
+  for (off = 0;off < size;off += len) {
+    len = size - off;
+    if (len > CHAIN_SLICE)
+      len = CHAIN_SLICE;
+    if (-1 != prev && rep->n_rows * len != xread(prev, partial,
+                                                 rep->n_rows * len))
+      xmsg("repair chain broken", "");
+    if (fd_is_hole(fd, off, len))
+      memset(slice, 0, len);
+    else
+      xpread(fd, slice, len, off);
+    //the partial of output i is the i-th len bytes
+    for (g = 0;g < rep->n_rows;g += MAT_MULTI_MAX) {
+      n = rep->n_rows - g;
+      if (n > MAT_MULTI_MAX)
+        n = MAT_MULTI_MAX;
+      for (i = 0;i < n;i++)
+        dst[i] = partial + (g + i) * len;
+      gf_region_mul_multi(dst, slice, &t[g], n, len, -1 != prev);
+    }
+    iov.iov_base = partial;
+    iov.iov_len = rep->n_rows * len;
+    xwritev(next, &iov, 1);
+  }
+  exit(0);
+}
+
+/**
+ * rebuild out_fds = rep * in_fds through a chain of rep->n_cols helper
+ * processes, helper j reading in_fds[j]
+ *
+ * @param rep repair matrix
+ * @param in_fds rep->n_cols fragments read, one per helper
+ * @param out_fds rep->n_rows fragments written, the slices of zeros being
+ *   left as holes
+ * @param size length of the fragments, cut to whole words
+ * @param crcs if not NULL, crcs[i] gets the CRC32C of every block of
+ *   out_fds[i]
+ *
+ * @return 0 on success, -1 if a helper failed
+ */
+int chain_repair(t_mat *rep, int *in_fds, int *out_fds, size_t size,
+                 u_int32_t **crcs)
+{
+  int n = rep->n_cols;
+  int socks[n][2];    /* helper j writes socks[j][0], reads socks[j-1][1] */
+  pid_t pids[n];
+  u_char *buf;
+  size_t off, len, b;
+  int i, j, k, status;
+  int ret = 0;
+
+  size = alignw(size);
+  //the slices are neither aligned nor whole pages: under -D go through
+  //the page cache
+  for (j = 0;dflag && j < n;j++)
+    fcntl(in_fds[j], F_SETFL, fcntl(in_fds[j], F_GETFL) & ~O_DIRECT);
+  for (i = 0;dflag && i < rep->n_rows;i++)
+    fcntl(out_fds[i], F_SETFL, fcntl(out_fds[i], F_GETFL) & ~O_DIRECT);
+  for (j = 0;j < n;j++) {
+    if (-1 == socketpair(AF_UNIX, SOCK_STREAM, 0, socks[j]))
+      xperror("socketpair");
+  }
+  fflush(NULL);
+  for (j = 0;j < n;j++) {
+    switch (pids[j] = fork()) {
+    case -1:
+      xperror("fork");
+    case 0:
+      for (k = 0;k < n;k++) {
+        if (k != j)
+          close(socks[k][0]);
+        if (k != j - 1)
+          close(socks[k][1]);
+      }
+      chain_helper(rep, j, in_fds[j], (0 == j) ? -1 : socks[j - 1][1],
+                   socks[j][0], size);
+    }
+  }
+  for (j = 0;j < n;j++) {
+    close(socks[j][0]);
+    if (j != n - 1)
+      close(socks[j][1]);
+  }
+  if (vflag)
+    fprintf(stderr, "repairing through a chain of %d helpers\n", n);
+
+  buf = xmalloc(rep->n_rows * CHAIN_SLICE);
+  for (off = 0;off < size;off += len) {
+    len = size - off;
+    if (len > CHAIN_SLICE)
+      len = CHAIN_SLICE;
+    if (rep->n_rows * len != xread(socks[n - 1][1], buf, rep->n_rows * len)) {
+      fprintf(stderr, "repair chain broken at offset %llu\n",
+              (unsigned long long) off);
+      ret = -1;
+      break ;
+    }
+    b = off / EC_BLOCK_SIZE;
+    for (i = 0;i < rep->n_rows;i++) {
+      //slices of zeros are left as holes
+      if (!mem_is_zero(buf + i * len, len) ||
+          0 != fd_punch_hole(out_fds[i], off, len))
+        xpwrite(out_fds[i], buf + i * len, len, off);
+      if (NULL != crcs)
+        crcs[i][b] = crc32c((0 == off % EC_BLOCK_SIZE) ? 0 : crcs[i][b],
+                            buf + i * len, len);
+    }
+  }
+  free(buf);
+  close(socks[n - 1][1]);
+  for (i = 0;0 == ret && i < rep->n_rows;i++) {
+    if (-1 == ftruncate(out_fds[i], size))
+      xperror("ftruncate");
+  }
+
+  for (j = 0;j < n;j++) {
+    if (-1 == waitpid(pids[j], &status, 0))
+      xperror("waitpid");
+    if (!WIFEXITED(status) || 0 != WEXITSTATUS(status))
+      ret = -1;
+  }
+  return ret;
+}
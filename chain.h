@@ -0,0 +1,2 @@
+extern int chain_repair(t_mat *rep, int *in_fds, int *out_fds, size_t size,
+                        u_int32_t **crcs);
@@ -0,0 +1,132 @@
+/**
+ * @file   crc.c
+ *
+ * @brief  CRC32C (Castagnoli) of regions, with the SSE4.2 crc32
+ *         instruction when the CPU has it and a byte-wise table otherwise.
+ *         The crc32 instruction has a latency of three cycles, so large
+ *         regions are cut into three lanes whose CRCs are computed side by
+ *         side then combined by shifting them over the lanes that follow.
+ */
+
+#include "ec.h"
+#if defined(__x86_64__)
+# include <immintrin.h>
+# define HAVE_X86_CRC
+#endif
+
+#define CRC32C_POLY 0x82f63b78  /* reflected */
+
+#define CRC_LANE 1024           /* bytes per lane of the SSE4.2 loop */
+
+static u_int32_t crc_table[256];
+/* crc_shift[k][v]: shift of v << 8k over CRC_LANE zero bytes */
+static u_int32_t crc_shift[4][256];
+
+static u_int32_t crc32c_table(u_int32_t crc, const u_char *p, size_t len)
+{
+  while (len-- > 0)
+    crc = crc_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+  return crc;
+}
+
+static u_int32_t crc_lane_shift(u_int32_t crc)
+{
+  return crc_shift[0][crc & 0xff] ^ crc_shift[1][(crc >> 8) & 0xff] ^
+    crc_shift[2][(crc >> 16) & 0xff] ^ crc_shift[3][crc >> 24];
+}
+
+#ifdef HAVE_X86_CRC
+__attribute__((target("sse4.2")))
+static u_int32_t crc32c_sse42(u_int32_t crc, const u_char *p, size_t len)
+{
+  const u_int64_t *q;
+  u_int64_t c = crc, c1, c2;
+  int i;
+
+  for (;len > 0 && 0 != ((size_t) p & 7);len--)
+    c = _mm_crc32_u8(c, *p++);
+  for (;len >= 3 * CRC_LANE;len -= 3 * CRC_LANE, p += 3 * CRC_LANE) {
+    q = (const u_int64_t *) p;
+    c1 = c2 = 0;
+    for (i = 0;i < CRC_LANE / 8;i++) {
+      c = _mm_crc32_u64(c, q[i]);
+      c1 = _mm_crc32_u64(c1, q[i + CRC_LANE / 8]);
+      c2 = _mm_crc32_u64(c2, q[i + 2 * CRC_LANE / 8]);
+    }
+    c = crc_lane_shift(crc_lane_shift(c) ^ c1) ^ c2;
+  }
+  for (;len >= 8;len -= 8, p += 8)
+    c = _mm_crc32_u64(c, *(const u_int64_t *) p);
+  for (;len > 0;len--)
+    c = _mm_crc32_u8(c, *p++);
+  return c;
+}
+#endif
+
+static u_int32_t (*crc_fn)(u_int32_t crc, const u_char *p, size_t len);
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static void crc_init()
+{
+  static const u_char zeros[CRC_LANE];
+  u_int32_t c, basis[32];
+  int i, k;
+
+  for (i = 0;i < 256;i++) {
+    c = i;
+    for (k = 0;k < 8;k++)
+      c = (c & 1) ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+    crc_table[i] = c;
+  }
+  //the shift is linear: shift each bit, then tabulate bytes
+  for (i = 0;i < 32;i++)
+    basis[i] = crc32c_table(1u << i, zeros, CRC_LANE);
+  for (k = 0;k < 4;k++) {
+    for (i = 0;i < 256;i++) {
+      crc_shift[k][i] = 0;
+      for (c = 0;c < 8;c++) {
+        if (i & (1 << c))
+          crc_shift[k][i] ^= basis[8 * k + c];
+      }
+    }
+  }
+  crc_fn = crc32c_table;
+#ifdef HAVE_X86_CRC
+  if (__builtin_cpu_supports("sse4.2"))
+    crc_fn = crc32c_sse42;
+#endif
+}
+
+/**
+ * CRC32C of a region, chained like zlib crc32()
+ *
+ * @param crc CRC32C of the preceding bytes, 0 to start
+ * @param buf region
+ * @param len length of the region in bytes
+ *
+ * @return the CRC32C of the preceding bytes followed by the region
+ */
+u_int32_t crc32c(u_int32_t crc, const void *buf, size_t len)
+{
+  pthread_once(&crc_once, crc_init);
+  return ~crc_fn(~crc, buf, len);
+}
+
+/**
+ * CRC32C of a run of zeros, without reading them: whole lanes are skipped
+ * with the lane shift
+ *
+ * @param len length of the run in bytes
+ *
+ * @return the CRC32C of len zero bytes
+ */
+u_int32_t crc32c_zeros(size_t len)
+{
+  static const u_char zeros[CRC_LANE];
+  u_int32_t c = ~0u;
+
+  pthread_once(&crc_once, crc_init);
+  for (;len >= CRC_LANE;len -= CRC_LANE)
+    c = crc_lane_shift(c);
+  return ~crc_fn(c, zeros, len);
+}
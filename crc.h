@@ -0,0 +1,2 @@
+extern u_int32_t crc32c(u_int32_t crc, const void *buf, size_t len);
+extern u_int32_t crc32c_zeros(size_t len);
@@ -0,0 +1,359 @@
+/**
+ * @file   daemon.c
+ *
+ * @brief  Daemon mode: encode, repair or verify objects on request over a
+ *         Unix socket, with the encoding matrix, the decode matrix cache
+ *         and a pool of worker processes kept from one request to the
+ *         next. A client connection is handed to an idle worker with
+ *         SCM_RIGHTS. The client passes its working directory and its
+ *         stderr the same way, so that its prefix is resolved and its
+ *         messages are printed on its side. As in batch mode a request
+ *         failing on an error only takes its worker down, which is then
+ *         replaced.
+ */
+
+#include "ec.h"
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+/* request: the operation byte followed by the prefix */
+#define DAEMON_REQ_MAX (1 + 1024)
+/* seconds a client has to send its request once connected */
+#define DAEMON_REQ_TIMEOUT 5
+
+typedef struct s_server
+{
+  pid_t pid;
+  int fd;           /* connections to the worker, status bytes back */
+  int busy;
+} t_server;
+
+/*
+ * send buf with n_fds descriptors attached
+ */
+static int send_fds(int sock, void *buf, size_t len, int *fds, int n_fds)
+{
+  char ctl[CMSG_SPACE(sizeof (int) * 2)];
+  struct msghdr msg;
+  struct cmsghdr *cmsg;
+  struct iovec iov;
+
+  assert(n_fds <= 2);
+  memset(&msg, 0, sizeof (msg));
+  memset(ctl, 0, sizeof (ctl));
+  iov.iov_base = buf;
+  iov.iov_len = len;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = ctl;
+  msg.msg_controllen = CMSG_SPACE(sizeof (int) * n_fds);
+  cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof (int) * n_fds);
+  memcpy(CMSG_DATA(cmsg), fds, sizeof (int) * n_fds);
+  return (len == sendmsg(sock, &msg, 0)) ? 0 : -1;
+}
+
+/*
+ * receive a message into buf and up to 2 descriptors into fds, the
+ * missing ones being set to -1: the length of the message, 0 at the end
+ * of the connection, -1 on error
+ */
+static ssize_t recv_fds(int sock, void *buf, size_t len, int *fds, int n_fds)
+{
+  char ctl[CMSG_SPACE(sizeof (int) * 2)];
+  struct msghdr msg;
+  struct cmsghdr *cmsg;
+  struct iovec iov;
+  ssize_t ret;
+  int i, n;
+
+  assert(n_fds <= 2);
+  for (i = 0;i < n_fds;i++)
+    fds[i] = -1;
+  memset(&msg, 0, sizeof (msg));
+  iov.iov_base = buf;
+  iov.iov_len = len;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = ctl;
+  msg.msg_controllen = sizeof (ctl);
+  do {
+    ret = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+  } while (-1 == ret && EINTR == errno);
+  if (ret <= 0)
+    return ret;
+  for (cmsg = CMSG_FIRSTHDR(&msg);cmsg;cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (SOL_SOCKET != cmsg->cmsg_level || SCM_RIGHTS != cmsg->cmsg_type)
+      continue ;
+    n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof (int);
+    for (i = 0;i < n;i++) {
+      if (i < n_fds)
+        memcpy(&fds[i], CMSG_DATA(cmsg) + i * sizeof (int), sizeof (int));
+      else
+        close(((int *) CMSG_DATA(cmsg))[i]);
+    }
+  }
+  return ret;
+}
+
+/*
+ * a prefix must name files below the client's directory: not absolute
+ * and without any ".." component
+ */
+static int prefix_ok(char *prefix)
+{
+  char *p;
+
+  if ('/' == prefix[0])
+    return 0;
+  for (p = prefix;p;p = strchr(p, '/')) {
+    if ('/' == *p)
+      p++;
+    if ('.' == p[0] && '.' == p[1] && ('/' == p[2] || 0 == p[2]))
+      return 0;
+  }
+  return 1;
+}
+
+/*
+ * run the request of a client connection in the client's directory, with
+ * its stderr: 0 on success, 1 if the operation failed, -1 if the request
+ * is malformed
+ */
+static int serve_request(t_mat *mat, int conn)
+{
+  char req[DAEMON_REQ_MAX + 1];
+  struct timeval tv;
+  int fds[2];
+  ssize_t len;
+  int ret = -1;
+
+  //a client connecting without sending must not hold the worker
+  tv.tv_sec = DAEMON_REQ_TIMEOUT;
+  tv.tv_usec = 0;
+  if (-1 == setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof (tv)))
+    return -1;
+  len = recv_fds(conn, req, DAEMON_REQ_MAX, fds, 2);
+  if (len >= 2)
+    req[len] = 0;
+  if (len >= 2 && -1 != fds[0] && -1 != fds[1] &&
+      (u_char) req[0] <= EC_BATCH_VERIFY && prefix_ok(req + 1) &&
+      -1 != fchdir(fds[0]) && -1 != dup2(fds[1], 2)) {
+    ret = (0 == batch_object(req[0], mat, req + 1)) ? 0 : 1;
+  }
+  if (-1 != fds[0])
+    close(fds[0]);
+  if (-1 != fds[1])
+    close(fds[1]);
+  return ret;
+}
+
+/*
+ * worker process: serve the connections received from the daemon until
+ * it goes away
+ */
+static void server_loop(t_mat *mat, int fd)
+{
+  u_char status;
+  int conn, err;
+
+  if (-1 == (err = dup(2)))
+    xperror("dup");
+  while (1) {
+    if (recv_fds(fd, &status, 1, &conn, 1) <= 0)
+      exit(0);
+    if (-1 == conn)
+      continue ;
+    status = (0 == serve_request(mat, conn)) ? 0 : 1;
+    fflush(stderr);
+    dup2(err, 2);
+    //the client may be gone already, its request is done anyway
+    send(conn, &status, 1, MSG_NOSIGNAL);
+    close(conn);
+    if (1 != write(fd, &status, 1))
+      exit(0);
+  }
+}
+
+static void server_spawn(t_server *servers, int n, int s, t_mat *mat,
+                         int listen_fd)
+{
+  int sv[2];
+  int i;
+
+  if (-1 == socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv))
+    xperror("socketpair");
+  fflush(NULL);
+  switch (servers[s].pid = fork()) {
+  case -1:
+    xperror("fork");
+  case 0:
+    close(sv[0]);
+    close(listen_fd);
+    for (i = 0;i < n;i++) {
+      if (i != s && -1 != servers[i].fd)
+        close(servers[i].fd);
+    }
+    server_loop(mat, sv[1]);
+  }
+  close(sv[1]);
+  servers[s].fd = sv[0];
+  servers[s].busy = 0;
+}
+
+/**
+ * serve encode, repair and verify requests on a Unix socket forever, on
+ * n_threads worker processes, each request being processed on a single
+ * thread
+ *
+ * @param mat encoding matrix
+ * @param path path of the socket, replaced if it exists
+ *
+ * @return -1 if the socket cannot be set up
+ */
+int daemon_serve(t_mat *mat, char *path)
+{
+  int n = n_threads;
+  t_server servers[n];
+  struct pollfd pfds[n + 1];
+  struct sockaddr_un addr;
+  u_char status;
+  mode_t mask;
+  int listen_fd, conn;
+  int i, n_idle, ret;
+
+  memset(&addr, 0, sizeof (addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof (addr.sun_path)) {
+    fprintf(stderr, "%s: socket path too long\n", path);
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+  if (-1 == (listen_fd = socket(AF_UNIX, SOCK_SEQPACKET, 0)))
+    xperror("socket");
+  unlink(path);
+  //only our user may connect: requests run with our rights
+  mask = umask(0177);
+  ret = bind(listen_fd, (struct sockaddr *) &addr, sizeof (addr));
+  umask(mask);
+  if (-1 == ret || -1 == chmod(path, 0600) || -1 == listen(listen_fd, 64)) {
+    fprintf(stderr, "%s: %s\n", path, strerror(errno));
+    close(listen_fd);
+    return -1;
+  }
+
+  //a client going away must not kill the daemon
+  signal(SIGPIPE, SIG_IGN);
+  n_threads = 1;
+  for (i = 0;i < n;i++)
+    servers[i].fd = -1;
+  for (i = 0;i < n;i++)
+    server_spawn(servers, n, i, mat, listen_fd);
+  if (vflag)
+    fprintf(stderr, "serving on %s with %d workers\n", path, n);
+
+  while (1) {
+    n_idle = 0;
+    for (i = 0;i < n;i++) {
+      pfds[i].fd = servers[i].fd;
+      pfds[i].events = POLLIN;
+      n_idle += !servers[i].busy;
+    }
+    //new connections wait in the backlog while every worker is busy
+    pfds[n].fd = (n_idle > 0) ? listen_fd : -1;
+    pfds[n].events = POLLIN;
+    if (-1 == poll(pfds, n + 1, -1)) {
+      if (EINTR == errno)
+        continue ;
+      xperror("poll");
+    }
+
+    for (i = 0;i < n;i++) {
+      if (0 == pfds[i].revents)
+        continue ;
+      if (1 == read(servers[i].fd, &status, 1)) {
+        servers[i].busy = 0;
+        continue ;
+      }
+      //the worker exited on an error, replace it
+      if (vflag)
+        fprintf(stderr, "worker %d exited, replacing it\n",
+                (int) servers[i].pid);
+      close(servers[i].fd);
+      servers[i].fd = -1;
+      waitpid(servers[i].pid, NULL, 0);
+      server_spawn(servers, n, i, mat, listen_fd);
+    }
+
+    if (0 == (pfds[n].revents & POLLIN))
+      continue ;
+    if (-1 == (conn = accept(listen_fd, NULL, NULL))) {
+      if (EINTR == errno || ECONNABORTED == errno)
+        continue ;
+      xperror("accept");
+    }
+    for (i = 0;i < n && servers[i].busy;i++)
+      ;
+    status = 0;
+    if (0 != send_fds(servers[i].fd, &status, 1, &conn, 1))
+      xperror("sendmsg");
+    servers[i].busy = 1;
+    close(conn);
+  }
+}
+
+/**
+ * have the daemon listening on path encode, repair or verify an object,
+ * in the current directory and with its messages on our stderr
+ *
+ * @param path path of the socket of the daemon
+ * @param op EC_BATCH_ENCODE, EC_BATCH_REPAIR or EC_BATCH_VERIFY
+ * @param prefix prefix of the files of the object
+ *
+ * @return 0 on success, -1 on failure
+ */
+int daemon_submit(char *path, int op, char *prefix)
+{
+  char req[DAEMON_REQ_MAX];
+  struct sockaddr_un addr;
+  u_char status;
+  int fds[2];
+  int sock;
+  size_t len;
+  int ret;
+
+  len = strlen(prefix);
+  if (len + 1 > sizeof (req) || strlen(path) >= sizeof (addr.sun_path))
+    xmsg("name too long", prefix);
+  memset(&addr, 0, sizeof (addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+  if (-1 == (sock = socket(AF_UNIX, SOCK_SEQPACKET, 0)))
+    xperror("socket");
+  if (-1 == connect(sock, (struct sockaddr *) &addr, sizeof (addr)))
+    xerrormsg("error connecting to", path);
+  if (-1 == (fds[0] = open(".", O_RDONLY | O_DIRECTORY)))
+    xperror("open");
+  fds[1] = 2;
+  req[0] = op;
+  memcpy(req + 1, prefix, len);
+  if (0 != send_fds(sock, req, len + 1, fds, 2))
+    xperror("sendmsg");
+  close(fds[0]);
+
+  if (1 != xread(sock, &status, 1)) {
+    fprintf(stderr, "%s: failed\n", prefix);
+    ret = -1;
+  } else {
+    ret = (0 == status) ? 0 : -1;
+  }
+  close(sock);
+  return ret;
+}
@@ -0,0 +1,2 @@
+extern int daemon_serve(t_mat *mat, char *path);
+extern int daemon_submit(char *path, int op, char *prefix);
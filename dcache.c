@@ -0,0 +1,327 @@
+/**
+ * @file   dcache.c
+ * 
+ * @brief  Decode matrix cache
+ *         Inverting a_prime only depends on the encoding matrix and on
+ *         which fragments survived, so the inverses are kept in an LRU
+ *         keyed by a fingerprint of the encoding matrix plus the bitmap of
+ *         the fragments used for decoding. The cache can also be backed
+ *         by an append-only file shared by successive runs.
+ */
+
+#include "ec.h"
+
+#define DCACHE_SIZE     128     /* max entries kept in memory */
+#define DCACHE_BUCKETS  64
+#define DCACHE_MAGIC    0x32434445      /* "EDC2", records with a CRC */
+
+typedef struct s_dcache_entry
+{
+  struct s_dcache_entry *hnext;     /* hash chain */
+  struct s_dcache_entry *prev;      /* LRU list, most recent first */
+  struct s_dcache_entry *next;
+  u_int64_t fp;                     /* encoding matrix fingerprint */
+  u_int n_rows;
+  u_int n_cols;
+  u_char *bitmap;
+  t_mat *inv;
+} t_dcache_entry;
+
+/* on-disk record header, followed by the bitmap and the inverse */
+typedef struct s_dcache_rec
+{
+  u_int32_t magic;
+  u_int32_t w;
+  u_int32_t n_rows;
+  u_int32_t n_cols;
+  u_int64_t fp;
+  u_int32_t crc;    /* CRC32C of the record, this field being 0 */
+  u_int32_t pad;
+} t_dcache_rec;
+
+static t_dcache_entry *buckets[DCACHE_BUCKETS];
+static t_dcache_entry *lru_head = NULL;
+static t_dcache_entry *lru_tail = NULL;
+static u_int n_entries = 0;
+static int cache_fd = -1;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static size_t bitmap_len(u_int n_rows, u_int n_cols)
+{
+  return (n_rows + n_cols + 7) / 8;
+}
+
+/*
+ * FNV-1a over the dimensions and the elements of the encoding matrix
+ */
+static u_int64_t mat_fingerprint(t_mat *mat)
+{
+  u_int64_t h = 14695981039346656037ULL;
+  u_int i, j;
+
+#define FNV(x) do { h ^= (u_int64_t) (x); h *= 1099511628211ULL; } while (0)
+  FNV(mat->n_rows);
+  FNV(mat->n_cols);
+  for (i = 0;i < mat->n_rows;i++)
+    for (j = 0;j < mat->n_cols;j++)
+      FNV(MAT_ITEM(mat, i, j));
+#undef FNV
+  return h;
+}
+
+static u_int bucket_of(u_int64_t fp, u_char *bitmap, size_t len)
+{
+  u_int64_t h = fp;
+  size_t i;
+
+  for (i = 0;i < len;i++)
+    h = (h ^ bitmap[i]) * 1099511628211ULL;
+  return h % DCACHE_BUCKETS;
+}
+
+static void lru_unlink(t_dcache_entry *e)
+{
+  if (NULL != e->prev)
+    e->prev->next = e->next;
+  else
+    lru_head = e->next;
+  if (NULL != e->next)
+    e->next->prev = e->prev;
+  else
+    lru_tail = e->prev;
+}
+
+static void lru_push(t_dcache_entry *e)
+{
+  e->prev = NULL;
+  e->next = lru_head;
+  if (NULL != lru_head)
+    lru_head->prev = e;
+  lru_head = e;
+  if (NULL == lru_tail)
+    lru_tail = e;
+}
+
+static t_dcache_entry *lookup(u_int64_t fp, u_int n_rows, u_int n_cols,
+                              u_char *bitmap)
+{
+  size_t len = bitmap_len(n_rows, n_cols);
+  t_dcache_entry *e;
+
+  for (e = buckets[bucket_of(fp, bitmap, len)];e != NULL;e = e->hnext) {
+    if (e->fp == fp && e->n_rows == n_rows && e->n_cols == n_cols &&
+        0 == memcmp(e->bitmap, bitmap, len))
+      return e;
+  }
+  return NULL;
+}
+
+static void evict()
+{
+  t_dcache_entry *e = lru_tail, **pp;
+
+  lru_unlink(e);
+  pp = &buckets[bucket_of(e->fp, e->bitmap, bitmap_len(e->n_rows, e->n_cols))];
+  while (*pp != e)
+    pp = &(*pp)->hnext;
+  *pp = e->hnext;
+  free(e->bitmap);
+  mat_free(e->inv);
+  free(e);
+  n_entries--;
+}
+
+/*
+ * insert a copy of inv, the caller holds the lock
+ */
+static void insert(u_int64_t fp, u_int n_rows, u_int n_cols, u_char *bitmap,
+                   t_mat *inv)
+{
+  size_t len = bitmap_len(n_rows, n_cols);
+  t_dcache_entry *e;
+  u_int b;
+
+  if (NULL != lookup(fp, n_rows, n_cols, bitmap))
+    return ;
+  if (DCACHE_SIZE == n_entries)
+    evict();
+  e = xmalloc(sizeof (*e));
+  e->fp = fp;
+  e->n_rows = n_rows;
+  e->n_cols = n_cols;
+  e->bitmap = xmalloc(len);
+  memcpy(e->bitmap, bitmap, len);
+  if (NULL == (e->inv = mat_dup(inv)))
+    xperror("malloc");
+  b = bucket_of(fp, bitmap, len);
+  e->hnext = buckets[b];
+  buckets[b] = e;
+  lru_push(e);
+  n_entries++;
+}
+
+/*
+ * CRC32C of a record: header with its crc zeroed, bitmap and elements
+ */
+static u_int32_t rec_crc(t_dcache_rec *rec, u_char *bitmap, size_t len,
+                         u_int32_t *elts, size_t n)
+{
+  t_dcache_rec hdr = *rec;
+  u_int32_t crc;
+
+  hdr.crc = 0;
+  crc = crc32c(0, &hdr, sizeof (hdr));
+  crc = crc32c(crc, bitmap, len);
+  return crc32c(crc, elts, sizeof (u_int32_t) * n);
+}
+
+/*
+ * read back the records of the cache file, stopping at the first one
+ * that is truncated, fails its CRC32C or does not make sense, as left by
+ * a bit flip or a torn append
+ */
+static void load(int fd)
+{
+  t_dcache_rec rec;
+  u_char *bitmap;
+  u_int32_t *elts;
+  t_mat *inv;
+  struct stat stbuf;
+  off_t pos;
+  size_t len, n;
+  u_int i;
+
+  while (sizeof (rec) == read(fd, &rec, sizeof (rec))) {
+    if (DCACHE_MAGIC != rec.magic || 0 == rec.n_cols ||
+        rec.n_rows + rec.n_cols > (1 << 16) || rec.w > 16)
+      break ;
+    len = bitmap_len(rec.n_rows, rec.n_cols);
+    n = (size_t) rec.n_cols * rec.n_cols;
+    //a corrupt size must not be allocated: the record has to fit in what
+    //is left of the file
+    if (-1 == fstat(fd, &stbuf) || -1 == (pos = lseek(fd, 0, SEEK_CUR)) ||
+        len + sizeof (u_int32_t) * n > stbuf.st_size - pos)
+      break ;
+    bitmap = xmalloc(len);
+    elts = xmalloc(sizeof (u_int32_t) * n);
+    if (len != read(fd, bitmap, len) ||
+        sizeof (u_int32_t) * n != read(fd, elts, sizeof (u_int32_t) * n)) {
+      free(bitmap);
+      free(elts);
+      break ;
+    }
+    for (i = 0;i < n && elts[i] < (1u << rec.w);i++)
+      ;
+    if (i < n || rec.crc != rec_crc(&rec, bitmap, len, elts, n)) {
+      if (vflag)
+        fprintf(stderr, "decode matrix cache: bad record, ignoring the "
+                "rest\n");
+      free(bitmap);
+      free(elts);
+      break ;
+    }
+    //records of other fields are simply skipped
+    if (get_w() == rec.w) {
+      inv = mat_xcalloc(rec.n_cols, rec.n_cols);
+      for (i = 0;i < n;i++)
+        inv->mem[i] = elts[i];
+      insert(rec.fp, rec.n_rows, rec.n_cols, bitmap, inv);
+      mat_free(inv);
+    }
+    free(bitmap);
+    free(elts);
+  }
+}
+
+/*
+ * append one record with a single write so that concurrent runs sharing
+ * the file do not interleave records
+ */
+static void append(u_int64_t fp, u_int n_rows, u_int n_cols, u_char *bitmap,
+                   t_mat *inv)
+{
+  size_t len = bitmap_len(n_rows, n_cols);
+  size_t n = n_cols * n_cols;
+  size_t size = sizeof (t_dcache_rec) + len + sizeof (u_int32_t) * n;
+  u_char *buf;
+  t_dcache_rec *rec;
+  u_int32_t *elts;
+  u_int i;
+
+  buf = xmalloc(size);
+  rec = (t_dcache_rec *) buf;
+  memset(rec, 0, sizeof (*rec));
+  rec->magic = DCACHE_MAGIC;
+  rec->w = get_w();
+  rec->n_rows = n_rows;
+  rec->n_cols = n_cols;
+  rec->fp = fp;
+  memcpy(buf + sizeof (*rec), bitmap, len);
+  elts = (u_int32_t *) (buf + sizeof (*rec) + len);
+  for (i = 0;i < n;i++)
+    elts[i] = inv->mem[i];
+  rec->crc = rec_crc(rec, bitmap, len, elts, n);
+  if (size != write(cache_fd, buf, size))
+    perror("writing decode matrix cache");
+  free(buf);
+}
+
+/** 
+ * set up the cache
+ * 
+ * @param path file backing the cache, or NULL to keep it in memory only
+ */
+void dcache_init(char *path)
+{
+  if (NULL == path)
+    return ;
+  if (-1 == (cache_fd = open(path, O_RDWR|O_CREAT|O_APPEND, 0666)))
+    xerrormsg("error opening", path);
+  load(cache_fd);
+}
+
+/** 
+ * look up the inverse of a_prime
+ * 
+ * @param mat encoding matrix
+ * @param bitmap fragments used for decoding: bit i for data i, bit
+ *   n_cols + i for coding i
+ * 
+ * @return a copy of the inverse to be freed by the caller, or NULL
+ */
+t_mat *dcache_get(t_mat *mat, u_char *bitmap)
+{
+  u_int64_t fp = mat_fingerprint(mat);
+  t_dcache_entry *e;
+  t_mat *inv = NULL;
+
+  pthread_mutex_lock(&cache_lock);
+  if (NULL != (e = lookup(fp, mat->n_rows, mat->n_cols, bitmap))) {
+    lru_unlink(e);
+    lru_push(e);
+    if (NULL == (inv = mat_dup(e->inv)))
+      xperror("malloc");
+  }
+  pthread_mutex_unlock(&cache_lock);
+  return inv;
+}
+
+/** 
+ * remember the inverse of a_prime
+ * 
+ * @param mat encoding matrix
+ * @param bitmap fragments used for decoding
+ * @param inv inverse, copied
+ */
+void dcache_put(t_mat *mat, u_char *bitmap, t_mat *inv)
+{
+  u_int64_t fp = mat_fingerprint(mat);
+
+  pthread_mutex_lock(&cache_lock);
+  if (NULL == lookup(fp, mat->n_rows, mat->n_cols, bitmap)) {
+    insert(fp, mat->n_rows, mat->n_cols, bitmap, inv);
+    if (-1 != cache_fd)
+      append(fp, mat->n_rows, mat->n_cols, bitmap, inv);
+  }
+  pthread_mutex_unlock(&cache_lock);
+}
@@ -0,0 +1,3 @@
+extern void dcache_init(char *path);
+extern t_mat *dcache_get(t_mat *mat, u_char *bitmap);
+extern void dcache_put(t_mat *mat, u_char *bitmap, t_mat *inv);
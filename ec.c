@@ -8,24 +8,724 @@
  *         http://www.cs.utk.edu/~plank/plank/papers/CS-96-332.html
  */
 
+#define _GNU_SOURCE     /* O_DIRECT */
 #include "ec.h"
 
+/*
+ * a block in flight through the pipeline, with its buffers
+ */
+typedef struct s_slot
+{
+  struct s_slot *next;
+  size_t off;
+  size_t len;
+  u_char **in;      /* n_cols buffers */
+  u_char **out;     /* n_rows buffers, NULL for the skipped outputs */
+  u_char **cmp;     /* n_rows buffers read from the outputs, verify only */
+  int zero;         /* the inputs are all zeros, the outputs not computed */
+} t_slot;
+
+typedef struct s_queue
+{
+  t_slot *head;
+  t_slot **tail;
+} t_queue;
+
+typedef struct s_apply
+{
+  t_mat *mat;
+  t_bitmat *bm;     /* XOR schedule of mat, NULL unless -X */
+  int *in_fds;
+  int *out_fds;
+  u_char **in_maps;   /* mapped inputs and outputs, NULL if not mapped */
+  u_char **out_maps;
+  size_t size;
+  off_t *mismatch;  /* verify: first mismatching offset of each output, -1
+                       if none yet. NULL when the outputs are written. */
+  u_int32_t **crcs; /* CRC32C of each block of the inputs then the outputs,
+                       NULL if not computed */
+  t_gf_tables *tables;  /* kernel tables of mat, column by column, when
+                           computing crcs without bm */
+  pthread_mutex_t lock;
+  size_t next;      /* mapped: offset of the next block to hand out */
+  pthread_cond_t cond;  /* signaled on every change of the queues */
+  t_queue free_q;   /* slots available to the reader */
+  t_queue read_q;   /* slots read, to be multiplied */
+  t_queue write_q;  /* slots multiplied, to be written */
+  int reading;      /* the reader has blocks left */
+  int n_computing;  /* workers still running */
+  size_t n_zero;    /* blocks of zeros, not multiplied */
+} t_apply;
+
+static void queue_init(t_queue *q)
+{
+  q->head = NULL;
+  q->tail = &q->head;
+}
+
+static void queue_push(t_queue *q, t_slot *slot)
+{
+  slot->next = NULL;
+  *q->tail = slot;
+  q->tail = &slot->next;
+}
+
+static t_slot *queue_pop(t_queue *q)
+{
+  t_slot *slot = q->head;
+
+  if (NULL != slot && NULL == (q->head = slot->next))
+    q->tail = &q->head;
+  return slot;
+}
+
+/*
+ * open a file with O_DIRECT under -D, falling back to the page cache on
+ * filesystems that refuse it
+ */
+static int ec_open(char *filename, int flags, mode_t mode)
+{
+  int fd;
+
+  if (dflag) {
+    if (-1 != (fd = open(filename, flags|O_DIRECT, mode)) || EINVAL != errno)
+      return fd;
+    if (vflag)
+      fprintf(stderr, "%s: O_DIRECT not supported\n", filename);
+  }
+  return open(filename, flags, mode);
+}
+
+/*
+ * read a block of len bytes at off. Under -D the length is rounded up
+ * to EC_DIRECT_ALIGN and the read is short at the end of the file.
+ */
+static void ec_pread(int fd, u_char *buf, size_t len, off_t off)
+{
+  ssize_t ret;
+
+  if (!dflag) {
+    xpread(fd, buf, len, off);
+    return ;
+  }
+  do {
+    ret = pread(fd, buf, EC_DIRECT_ROUND(len), off);
+  } while (-1 == ret && EINTR == errno);
+  if (-1 == ret)
+    xperror("pread");
+  if (ret < len)
+    xmsg("short read", "");
+}
+
+/*
+ * multiply the block at off. With crcs, the block is multiplied tile by
+ * tile and the CRC32C of the inputs and outputs are chained over each
+ * tile while it is still in cache, sparing a checksum pass. scratch is the
+ * bit-matrix scratch of the calling worker, NULL unless -X.
+ */
+static void ec_mult(t_apply *ap, size_t off, u_char **in, u_char **out,
+                    size_t len, u_char *scratch)
+{
+  t_mat *mat = ap->mat;
+  u_int32_t **crcs = ap->crcs;
+  size_t b = off / EC_BLOCK_SIZE;
+  u_char *tin[mat->n_cols];
+  u_char *tout[mat->n_rows];
+  size_t done, step, n;
+  int i, j;
+
+  if (NULL == crcs) {
+    if (NULL != ap->bm)
+      bitmat_mult_region(ap->bm, in, out, len, scratch);
+    else
+      mat_mult_region(mat, in, out, len);
+    return ;
+  }
+
+  //tiles of whole bit-matrix chunks under -X
+  step = (NULL != ap->bm) ? ap->bm->w * EC_PACKET_SIZE : MAT_TILE_SIZE;
+  for (j = 0;j < mat->n_cols + mat->n_rows;j++)
+    crcs[j][b] = 0;
+  for (done = 0;done < len;done += n) {
+    n = len - done;
+    if (n > step)
+      n = step;
+    for (j = 0;j < mat->n_cols;j++)
+      tin[j] = in[j] + done;
+    for (i = 0;i < mat->n_rows;i++)
+      tout[i] = out[i] + done;
+    if (NULL != ap->bm)
+      bitmat_mult_region(ap->bm, tin, tout, n, NULL);
+    else
+      mat_mult_region_tables(mat->n_rows, mat->n_cols, ap->tables, tin, tout,
+                             n);
+    for (j = 0;j < mat->n_cols;j++)
+      crcs[j][b] = crc32c(crcs[j][b], tin[j], n);
+    for (i = 0;i < mat->n_rows;i++)
+      crcs[mat->n_cols + i][b] = crc32c(crcs[mat->n_cols + i][b], tout[i], n);
+  }
+}
+
+/*
+ * whether the block at off is zeros in every input, the holes being told
+ * by the file system and the rest checked in memory. mapped says whether
+ * in points to the mappings, otherwise the blocks outside the holes are
+ * read into in, and those in the holes zeroed only if the block has data.
+ */
+static int ec_zero_inputs(t_apply *ap, size_t off, u_char **in, size_t len,
+                          int mapped)
+{
+  int n = ap->mat->n_cols;
+  u_char hole[n];
+  int j, zero = 1;
+
+  for (j = 0;j < n;j++) {
+    if ((hole[j] = fd_is_hole(ap->in_fds[j], off, len)))
+      continue ;
+    if (!mapped)
+      ec_pread(ap->in_fds[j], in[j], len, off);
+    if (zero)
+      zero = mem_is_zero(in[j], len);
+  }
+  for (j = 0;!zero && !mapped && j < n;j++) {
+    if (hole[j])
+      memset(in[j], 0, len);
+  }
+  return zero;
+}
+
+/*
+ * the block at off is zeros in every input, hence in every output: only
+ * the CRCs are set, and the outputs zeroed when they are compared
+ */
+static void ec_zero(t_apply *ap, size_t off, u_char **out, size_t len)
+{
+  t_mat *mat = ap->mat;
+  size_t b = off / EC_BLOCK_SIZE;
+  u_int32_t crc;
+  int i, j;
+
+  if (NULL != ap->crcs) {
+    crc = crc32c_zeros(len);
+    for (j = 0;j < mat->n_cols + mat->n_rows;j++)
+      ap->crcs[j][b] = crc;
+  }
+  for (i = 0;NULL != ap->mismatch && i < mat->n_rows;i++) {
+    if (NULL != out[i])
+      memset(out[i], 0, len);
+  }
+  pthread_mutex_lock(&ap->lock);
+  ap->n_zero++;
+  pthread_mutex_unlock(&ap->lock);
+}
+
+/*
+ * zero the block of len bytes at off of a fragment written, punching a
+ * hole where the file system can, writing buf zeroed otherwise
+ */
+static void ec_write_zero(int fd, u_char *buf, size_t len, off_t off)
+{
+  if (0 == fd_punch_hole(fd, off, len))
+    return ;
+  memset(buf, 0, dflag ? EC_DIRECT_ROUND(len) : len);
+  xpwrite(fd, buf, dflag ? EC_DIRECT_ROUND(len) : len, off);
+}
+
+/*
+ * verify: compare the outputs computed for the block at off with the
+ * contents of the output files, keeping the lowest mismatching offset of
+ * each since the blocks complete out of order
+ */
+static void ec_compare(t_apply *ap, size_t off, u_char **out, u_char **cmp,
+                       size_t len)
+{
+  size_t k;
+  int i;
+
+  for (i = 0;i < ap->mat->n_rows;i++) {
+    if (NULL == out[i] || 0 == memcmp(out[i], cmp[i], len))
+      continue ;
+    for (k = 0;out[i][k] == cmp[i][k];k++)
+      ;
+    pthread_mutex_lock(&ap->lock);
+    if (-1 == ap->mismatch[i] || off + k < ap->mismatch[i])
+      ap->mismatch[i] = off + k;
+    pthread_mutex_unlock(&ap->lock);
+  }
+}
+
+/*
+ * mapped worker loop: grab the next block and multiply it from the input
+ * mappings into the output mappings, until the range is exhausted
+ */
+static void *ec_map_worker(void *arg)
+{
+  t_apply *ap = arg;
+  t_mat *mat = ap->mat;
+  u_char *in[mat->n_cols];
+  u_char *out[mat->n_rows];
+  u_char *bufs[mat->n_rows];
+  u_char *cmp[mat->n_rows];
+  u_char *scratch;
+  size_t off, len;
+  int i, j;
+
+  scratch = (NULL != ap->bm) ? xmalloc(BITMAT_SCRATCH_SIZE(ap->bm)) : NULL;
+  //verify computes into buffers of its own, the outputs being read-only
+  for (i = 0;i < mat->n_rows;i++)
+    bufs[i] = (NULL == ap->mismatch || NULL == ap->out_maps[i]) ?
+      NULL : pool_get();
+
+  while (1) {
+    pthread_mutex_lock(&ap->lock);
+    off = ap->next;
+    ap->next += EC_BLOCK_SIZE;
+    pthread_mutex_unlock(&ap->lock);
+    if (off >= ap->size)
+      break ;
+    len = ap->size - off;
+    if (len > EC_BLOCK_SIZE)
+      len = EC_BLOCK_SIZE;
+    for (j = 0;j < mat->n_cols;j++)
+      in[j] = ap->in_maps[j] + off;
+    for (i = 0;i < mat->n_rows;i++) {
+      if (NULL != bufs[i])
+        cmp[i] = ap->out_maps[i] + off;
+      out[i] = (NULL != bufs[i]) ? bufs[i] :
+        (NULL == ap->out_maps[i]) ? NULL : ap->out_maps[i] + off;
+    }
+    if (!ec_zero_inputs(ap, off, in, len, 1)) {
+      ec_mult(ap, off, in, out, len, scratch);
+    } else {
+      ec_zero(ap, off, out, len);
+      //give back the blocks pre-allocated by ec_map
+      for (i = 0;NULL == ap->mismatch && i < mat->n_rows;i++) {
+        if (NULL != out[i] && 0 != fd_punch_hole(ap->out_fds[i], off, len))
+          memset(out[i], 0, len);
+      }
+    }
+    if (NULL != ap->mismatch)
+      ec_compare(ap, off, out, cmp, len);
+  }
+  for (i = 0;i < mat->n_rows;i++)
+    pool_put(bufs[i]);
+  free(scratch);
+  return NULL;
+}
+
+/*
+ * first stage: read the blocks in order into free slots
+ */
+static void *ec_reader(void *arg)
+{
+  t_apply *ap = arg;
+  t_slot *slot;
+  size_t off;
+  int i;
+
+  for (off = 0;off < ap->size;off += EC_BLOCK_SIZE) {
+    pthread_mutex_lock(&ap->lock);
+    while (NULL == (slot = queue_pop(&ap->free_q)))
+      pthread_cond_wait(&ap->cond, &ap->lock);
+    pthread_mutex_unlock(&ap->lock);
+    slot->off = off;
+    slot->len = ap->size - off;
+    if (slot->len > EC_BLOCK_SIZE)
+      slot->len = EC_BLOCK_SIZE;
+    slot->zero = ec_zero_inputs(ap, off, slot->in, slot->len, 0);
+    for (i = 0;NULL != ap->mismatch && i < ap->mat->n_rows;i++) {
+      if (-1 != ap->out_fds[i])
+        ec_pread(ap->out_fds[i], slot->cmp[i], slot->len, off);
+    }
+    pthread_mutex_lock(&ap->lock);
+    queue_push(&ap->read_q, slot);
+    pthread_cond_broadcast(&ap->cond);
+    pthread_mutex_unlock(&ap->lock);
+  }
+  pthread_mutex_lock(&ap->lock);
+  ap->reading = 0;
+  pthread_cond_broadcast(&ap->cond);
+  pthread_mutex_unlock(&ap->lock);
+  return NULL;
+}
+
+/*
+ * second stage, on n_threads threads: multiply the slots read
+ */
+static void *ec_worker(void *arg)
+{
+  t_apply *ap = arg;
+  t_slot *slot;
+  u_char *scratch;
+
+  scratch = (NULL != ap->bm) ? xmalloc(BITMAT_SCRATCH_SIZE(ap->bm)) : NULL;
+  while (1) {
+    pthread_mutex_lock(&ap->lock);
+    while (NULL == (slot = queue_pop(&ap->read_q)) && ap->reading)
+      pthread_cond_wait(&ap->cond, &ap->lock);
+    if (NULL == slot) {
+      ap->n_computing--;
+      pthread_cond_broadcast(&ap->cond);
+      pthread_mutex_unlock(&ap->lock);
+      break ;
+    }
+    pthread_mutex_unlock(&ap->lock);
+    if (slot->zero)
+      ec_zero(ap, slot->off, slot->out, slot->len);
+    else
+      ec_mult(ap, slot->off, slot->in, slot->out, slot->len, scratch);
+    if (NULL != ap->mismatch)
+      ec_compare(ap, slot->off, slot->out, slot->cmp, slot->len);
+    pthread_mutex_lock(&ap->lock);
+    queue_push(&ap->write_q, slot);
+    pthread_cond_broadcast(&ap->cond);
+    pthread_mutex_unlock(&ap->lock);
+  }
+  free(scratch);
+  return NULL;
+}
+
+/*
+ * last stage: write the slots multiplied, unless verifying, and give them
+ * back to the reader. The blocks of zeros are punched rather than written.
+ * ec_apply sets the final size, truncating the padding of the tail under
+ * -D and extending the outputs over a trailing hole.
+ */
+static void ec_writer(t_apply *ap)
+{
+  t_slot *slot;
+  int i;
+
+  while (1) {
+    pthread_mutex_lock(&ap->lock);
+    while (NULL == (slot = queue_pop(&ap->write_q)) && ap->n_computing > 0)
+      pthread_cond_wait(&ap->cond, &ap->lock);
+    pthread_mutex_unlock(&ap->lock);
+    if (NULL == slot)
+      break ;
+    for (i = 0;NULL == ap->mismatch && i < ap->mat->n_rows;i++) {
+      if (NULL == slot->out[i])
+        continue ;
+      if (slot->zero)
+        ec_write_zero(ap->out_fds[i], slot->out[i], slot->len, slot->off);
+      else
+        xpwrite(ap->out_fds[i], slot->out[i],
+                dflag ? EC_DIRECT_ROUND(slot->len) : slot->len, slot->off);
+    }
+    pthread_mutex_lock(&ap->lock);
+    queue_push(&ap->free_q, slot);
+    pthread_cond_broadcast(&ap->cond);
+    pthread_mutex_unlock(&ap->lock);
+  }
+}
+
+/*
+ * read, multiply and write as a pipeline: a reader thread fills the slots
+ * ahead of the n workers while the caller writes the slots they are done
+ * with, so that with two slots more than workers the reads of block N+1
+ * and the writes of block N-1 overlap the multiplication of block N
+ */
+static void ec_pipeline(t_apply *ap, int n)
+{
+  t_mat *mat = ap->mat;
+  int n_slots = n + 2;
+  t_slot slots[n_slots];
+  pthread_t reader, threads[n];
+  int i, j, k;
+
+  pthread_cond_init(&ap->cond, NULL);
+  queue_init(&ap->free_q);
+  queue_init(&ap->read_q);
+  queue_init(&ap->write_q);
+  for (k = 0;k < n_slots;k++) {
+    slots[k].in = xmalloc(sizeof (u_char *) * mat->n_cols);
+    slots[k].out = xmalloc(sizeof (u_char *) * mat->n_rows);
+    slots[k].cmp = xmalloc(sizeof (u_char *) * mat->n_rows);
+    for (j = 0;j < mat->n_cols;j++)
+      slots[k].in[j] = pool_get();
+    for (i = 0;i < mat->n_rows;i++) {
+      slots[k].out[i] = (-1 == ap->out_fds[i]) ? NULL : pool_get();
+      slots[k].cmp[i] = (-1 == ap->out_fds[i] || NULL == ap->mismatch) ?
+        NULL : pool_get();
+    }
+    queue_push(&ap->free_q, &slots[k]);
+  }
+  ap->reading = 1;
+  ap->n_computing = n;
+
+  if (0 != (errno = pthread_create(&reader, NULL, ec_reader, ap)))
+    xperror("pthread_create");
+  for (i = 0;i < n;i++) {
+    if (0 != (errno = pthread_create(&threads[i], NULL, ec_worker, ap)))
+      xperror("pthread_create");
+  }
+  ec_writer(ap);
+  pthread_join(reader, NULL);
+  for (i = 0;i < n;i++)
+    pthread_join(threads[i], NULL);
+
+  for (k = 0;k < n_slots;k++) {
+    for (j = 0;j < mat->n_cols;j++)
+      pool_put(slots[k].in[j]);
+    for (i = 0;i < mat->n_rows;i++) {
+      pool_put(slots[k].out[i]);
+      pool_put(slots[k].cmp[i]);
+    }
+    free(slots[k].in);
+    free(slots[k].out);
+    free(slots[k].cmp);
+  }
+  pthread_cond_destroy(&ap->cond);
+}
+
+/*
+ * map the inputs read-only and the outputs read-write, the latter being
+ * pre-sized first so that the stores do not fault on a hole. The outputs
+ * are only read when verifying.
+ */
+static void ec_map(t_apply *ap)
+{
+  t_mat *mat = ap->mat;
+  int i, j;
+
+  ap->in_maps = xmalloc(sizeof (u_char *) * mat->n_cols);
+  ap->out_maps = xmalloc(sizeof (u_char *) * mat->n_rows);
+  for (j = 0;j < mat->n_cols;j++) {
+    ap->in_maps[j] = xmmap(ap->in_fds[j], ap->size, PROT_READ);
+    madvise(ap->in_maps[j], ap->size, MADV_SEQUENTIAL);
+  }
+  for (i = 0;i < mat->n_rows;i++) {
+    ap->out_maps[i] = NULL;
+    if (-1 == ap->out_fds[i])
+      continue ;
+    if (NULL != ap->mismatch) {
+      ap->out_maps[i] = xmmap(ap->out_fds[i], ap->size, PROT_READ);
+      madvise(ap->out_maps[i], ap->size, MADV_SEQUENTIAL);
+      continue ;
+    }
+    if (-1 == ftruncate(ap->out_fds[i], ap->size))
+      xperror("ftruncate");
+    if (0 != (errno = posix_fallocate(ap->out_fds[i], 0, ap->size)))
+      xperror("posix_fallocate");
+    ap->out_maps[i] = xmmap(ap->out_fds[i], ap->size, PROT_READ|PROT_WRITE);
+    madvise(ap->out_maps[i], ap->size, MADV_SEQUENTIAL);
+  }
+}
+
+static void ec_unmap(t_apply *ap)
+{
+  t_mat *mat = ap->mat;
+  int i, j;
+
+  for (j = 0;j < mat->n_cols;j++)
+    munmap(ap->in_maps[j], ap->size);
+  for (i = 0;i < mat->n_rows;i++) {
+    if (NULL != ap->out_maps[i])
+      munmap(ap->out_maps[i], ap->size);
+  }
+  free(ap->in_maps);
+  free(ap->out_maps);
+}
+
+/*
+ * stream the in_fds through mat into the out_fds, block by block, on
+ * n_threads threads: out[i] = sum_j mat[i][j] * in[j], with the
+ * bit-matrix of mat under -X. out_fds entries set to -1 are skipped.
+ * Mapped files are multiplied in place, the others go through the
+ * read/multiply/write pipeline.
+ * With mismatch set, the out_fds are read and compared with the product
+ * instead of written, mismatch[i] getting the first differing offset of
+ * out_fds[i] or -1.
+ * With crcs set, crcs[j] and crcs[n_cols + i] get the CRC32C of every
+ * block of in_fds[j] and out_fds[i], none of which may be skipped.
+ * The blocks that are zeros in every input are not multiplied, and are
+ * left as holes in the outputs.
+ */
+static void ec_apply(t_mat *mat, int *in_fds, int *out_fds, size_t size,
+                     off_t *mismatch, u_int32_t **crcs)
+{
+  t_apply ap;
+  int n = n_threads;
+  pthread_t threads[n];
+  int i, j;
+
+  ap.mat = mat;
+  ap.bm = NULL;
+  ap.in_fds = in_fds;
+  ap.out_fds = out_fds;
+  ap.in_maps = NULL;
+  ap.out_maps = NULL;
+  ap.size = alignw(size);
+  ap.mismatch = mismatch;
+  ap.crcs = crcs;
+  ap.tables = NULL;
+  ap.next = 0;
+  ap.n_zero = 0;
+  pthread_mutex_init(&ap.lock, NULL);
+
+  if (xflag) {
+    if (NULL == (ap.bm = bitmat_create(mat)))
+      xperror("malloc");
+    if (vflag)
+      fprintf(stderr, "bit-matrix schedule: %d XORs per %d byte chunk\n",
+              bitmat_n_xors(ap.bm), ap.bm->w * EC_PACKET_SIZE);
+  }
+
+  if (NULL != crcs && NULL == ap.bm) {
+    ap.tables = xmalloc(sizeof (t_gf_tables) * mat->n_rows * mat->n_cols);
+    for (j = 0;j < mat->n_cols;j++)
+      for (i = 0;i < mat->n_rows;i++)
+        gf_tables_init(&ap.tables[j * mat->n_rows + i], MAT_ITEM(mat, i, j));
+  }
+
+  //empty files cannot be mapped
+  if (mflag && ap.size > 0)
+    ec_map(&ap);
+
+  //no point in more threads than blocks
+  if (n > (ap.size + EC_BLOCK_SIZE - 1) / EC_BLOCK_SIZE)
+    n = (ap.size + EC_BLOCK_SIZE - 1) / EC_BLOCK_SIZE;
+
+  if (NULL == ap.in_maps) {
+    ec_pipeline(&ap, (n < 1) ? 1 : n);
+  } else if (n <= 1) {
+    ec_map_worker(&ap);
+  } else {
+    for (i = 0;i < n;i++) {
+      if (0 != (errno = pthread_create(&threads[i], NULL, ec_map_worker, &ap)))
+        xperror("pthread_create");
+    }
+    for (i = 0;i < n;i++)
+      pthread_join(threads[i], NULL);
+  }
+
+  if (vflag && ap.n_zero > 0)
+    fprintf(stderr, "%llu blocks of zeros skipped\n",
+            (unsigned long long) ap.n_zero);
+  if (NULL == mismatch) {
+    for (i = 0;i < mat->n_rows;i++) {
+      if (-1 != out_fds[i] && -1 == ftruncate(out_fds[i], ap.size))
+        xperror("ftruncate");
+    }
+  }
+
+  if (NULL != ap.in_maps)
+    ec_unmap(&ap);
+  bitmat_free(ap.bm);
+  free(ap.tables);
+  pthread_mutex_destroy(&ap.lock);
+}
+
+/*
+ * Checksum sidecars: filename.crc holds the CRC32C of every EC_BLOCK_SIZE
+ * block of filename, as little endian 32-bit words.
+ */
+
+/*
+ * load the sidecar of filename, NULL if it is missing or does not cover
+ * n_blocks blocks
+ */
+static u_int32_t *crc_load(char *filename, size_t n_blocks)
+{
+  char crcname[1024 + sizeof (".crc")];
+  struct stat stbuf;
+  u_int32_t *crcs;
+  size_t b;
+  int fd;
+
+  snprintf(crcname, sizeof (crcname), "%s.crc", filename);
+  if (-1 == (fd = open(crcname, O_RDONLY)))
+    return NULL;
+  if (-1 == fstat(fd, &stbuf))
+    xerrormsg("error stating", crcname);
+  if (stbuf.st_size != n_blocks * sizeof (u_int32_t)) {
+    if (vflag)
+      fprintf(stderr, "%s: bad size, ignored\n", crcname);
+    close(fd);
+    return NULL;
+  }
+  //one spare word so that empty files still get a buffer
+  crcs = xmalloc((n_blocks + 1) * sizeof (u_int32_t));
+  xpread(fd, crcs, n_blocks * sizeof (u_int32_t), 0);
+  for (b = 0;b < n_blocks;b++)
+    crcs[b] = le32toh(crcs[b]);
+  close(fd);
+  return crcs;
+}
+
+static void crc_store(char *filename, u_int32_t *crcs, size_t n_blocks)
+{
+  char crcname[1024 + sizeof (".crc")];
+  u_int32_t *buf;
+  size_t b;
+  int fd;
+
+  snprintf(crcname, sizeof (crcname), "%s.crc", filename);
+  if (-1 == (fd = open(crcname, O_WRONLY|O_CREAT|O_TRUNC, 0666)))
+    xerrormsg("error opening", crcname);
+  buf = xmalloc((n_blocks + 1) * sizeof (u_int32_t));
+  for (b = 0;b < n_blocks;b++)
+    buf[b] = htole32(crcs[b]);
+  xpwrite(fd, buf, n_blocks * sizeof (u_int32_t), 0);
+  free(buf);
+  close(fd);
+}
+
+static int crc_exists(char *filename)
+{
+  char crcname[1024 + sizeof (".crc")];
+
+  snprintf(crcname, sizeof (crcname), "%s.crc", filename);
+  return 0 == access(crcname, F_OK);
+}
+
+/*
+ * recompute the sidecar words of the blocks of filename, of the given
+ * size, overlapping [offset, offset + len[, if it has a sidecar
+ */
+static void crc_refresh(char *filename, int fd, size_t size, off_t offset,
+                        size_t len)
+{
+  char crcname[1024 + sizeof (".crc")];
+  u_char *buf;
+  u_int32_t crc;
+  size_t b, off, blen;
+  int crc_fd;
+
+  snprintf(crcname, sizeof (crcname), "%s.crc", filename);
+  if (-1 == (crc_fd = open(crcname, O_WRONLY)))
+    return ;
+  buf = xmalloc(EC_BLOCK_SIZE);
+  for (b = offset / EC_BLOCK_SIZE;b < EC_N_BLOCKS(offset + len);b++) {
+    off = b * EC_BLOCK_SIZE;
+    blen = size - off;
+    if (blen > EC_BLOCK_SIZE)
+      blen = EC_BLOCK_SIZE;
+    xpread(fd, buf, blen, off);
+    crc = htole32(crc32c(0, buf, blen));
+    xpwrite(crc_fd, &crc, sizeof (crc), b * sizeof (crc));
+  }
+  free(buf);
+  close(crc_fd);
+}
+
 /** 
- * (re-)create missing prefix.c1 ... cm files acc/to Vandermonde matrix
+ * (re-)create missing prefix.c1 ... cm files acc/to Vandermonde matrix,
+ * along with the checksum sidecars of all the files
  * 
  * @param prefix prefix of files
  * @param mat Vandermonde matrix
  */
 void create_coding_files(char *prefix, t_mat *mat)
 {
-  int i, j;
-  FILE *d_files[mat->n_cols];
-  FILE *c_files[mat->n_rows];
+  int i;
+  int d_fds[mat->n_cols];
+  int c_fds[mat->n_rows];
+  u_int32_t *crcs[mat->n_cols + mat->n_rows];
   char filename[1024];
   struct stat stbuf;
-  size_t size = -1, wc;
-  t_vec *words = NULL;
-  t_vec *output = NULL;
+  size_t size = -1;
+  size_t n_blocks;
 
   if (vflag) {
     fprintf(stderr, "encoding matrix:\n");
@@ -34,88 +734,614 @@ void create_coding_files(char *prefix, t_mat *mat)
 
   for (i = 0;i < mat->n_cols;i++) {
     snprintf(filename, sizeof (filename), "%s.d%d", prefix, i);
-    if (NULL == (d_files[i] = fopen(filename, "r")))
+    if (-1 == (d_fds[i] = ec_open(filename, O_RDONLY, 0)))
       xerrormsg("error opening", filename);
-    if (-1 == fstat(fileno(d_files[i]), &stbuf))
+    if (-1 == fstat(d_fds[i], &stbuf))
       xerrormsg("error stating", filename);
     if (-1 == size)
       size = stbuf.st_size;
     else if (size != stbuf.st_size)
       xmsg("bad size", filename);
   }
+  //an odd tail byte would be neither coded nor covered by the sidecars
+  if (alignw(size) != size)
+    xmsg("size not a multiple of the word size:", filename);
   
   for (i = 0;i < mat->n_rows;i++) {
     snprintf(filename, sizeof (filename), "%s.c%d", prefix, i);
-    if (NULL == (c_files[i] = fopen(filename, "w")))
+    if (-1 == (c_fds[i] = ec_open(filename, O_RDWR|O_CREAT|O_TRUNC, 0666)))
       xerrormsg("error opening", filename);
   }
-  
-  words = vec_xcalloc(mat->n_cols);
-  output = vec_xcalloc(mat->n_cols);
-  
-  for (i = 0;i < sizew(size);i++) {
-    vec_zero(words);
-    for (j = 0;j < mat->n_cols;j++) {
-      wc = freadw(&VEC_ITEM(words, j), d_files[j]);
-      if (1 != wc)
-        xperror("short read data");
-    }
-    mat_mult(output, mat, words);
-    for (j = 0;j < mat->n_rows;j++) {
-      wc = fwritew(& VEC_ITEM(output, j), c_files[j]);
-      if (1 != wc)
-        xperror("short write coding");
-    }
-  } 
+
+  n_blocks = EC_N_BLOCKS(alignw(size));
+  for (i = 0;i < mat->n_cols + mat->n_rows;i++)
+    crcs[i] = xmalloc((n_blocks + 1) * sizeof (u_int32_t));
+
+  ec_apply(mat, d_fds, c_fds, size, NULL, crcs);
     
   for (i = 0;i < mat->n_cols;i++) {
-    fclose(d_files[i]);
+    close(d_fds[i]);
+    snprintf(filename, sizeof (filename), "%s.d%d", prefix, i);
+    crc_store(filename, crcs[i], n_blocks);
   }
   
   for (i = 0;i < mat->n_rows;i++) {
-    fclose(c_files[i]);
+    close(c_fds[i]);
+    snprintf(filename, sizeof (filename), "%s.c%d", prefix, i);
+    crc_store(filename, crcs[mat->n_cols + i], n_blocks);
   }
 
-  vec_free(words);
-  vec_free(output);
+  for (i = 0;i < mat->n_cols + mat->n_rows;i++)
+    free(crcs[i]);
 }
 
 /** 
- * repair data files
+ * check that the coding files match the data files: recompute the coding
+ * in memory block by block and report the first mismatching offset of
+ * each coding file, without writing anything
+ * 
+ * @param prefix prefix of files
+ * @param mat encoding matrix
+ * 
+ * @return 0 if all the coding files match, -1 otherwise
+ */
+int verify_coding_files(char *prefix, t_mat *mat)
+{
+  int i;
+  int d_fds[mat->n_cols];
+  int c_fds[mat->n_rows];
+  off_t mismatch[mat->n_rows];
+  char filename[1024];
+  struct stat stbuf;
+  size_t size = -1;
+  int ret = 0;
+
+  for (i = 0;i < mat->n_cols;i++) {
+    snprintf(filename, sizeof (filename), "%s.d%d", prefix, i);
+    if (-1 == (d_fds[i] = ec_open(filename, O_RDONLY, 0)))
+      xerrormsg("error opening", filename);
+    if (-1 == fstat(d_fds[i], &stbuf))
+      xerrormsg("error stating", filename);
+    if (-1 == size)
+      size = stbuf.st_size;
+    else if (size != stbuf.st_size)
+      xmsg("bad size", filename);
+  }
+
+  //missing or truncated coding files are reported but not compared
+  for (i = 0;i < mat->n_rows;i++) {
+    mismatch[i] = -1;
+    snprintf(filename, sizeof (filename), "%s.c%d", prefix, i);
+    if (-1 == (c_fds[i] = ec_open(filename, O_RDONLY, 0))) {
+      fprintf(stderr, "%s: %s\n", filename, strerror(errno));
+      ret = -1;
+      continue ;
+    }
+    if (-1 == fstat(c_fds[i], &stbuf))
+      xerrormsg("error stating", filename);
+    if (alignw(size) != stbuf.st_size) {
+      fprintf(stderr, "%s: bad size %llu, expected %llu\n", filename,
+              (unsigned long long) stbuf.st_size,
+              (unsigned long long) alignw(size));
+      close(c_fds[i]);
+      c_fds[i] = -1;
+      ret = -1;
+    }
+  }
+
+  ec_apply(mat, d_fds, c_fds, size, mismatch, NULL);
+
+  for (i = 0;i < mat->n_rows;i++) {
+    snprintf(filename, sizeof (filename), "%s.c%d", prefix, i);
+    if (-1 != mismatch[i]) {
+      fprintf(stderr, "%s: mismatch at offset %llu\n", filename,
+              (unsigned long long) mismatch[i]);
+      ret = -1;
+    } else if (-1 != c_fds[i] && vflag) {
+      fprintf(stderr, "%s: ok\n", filename);
+    }
+  }
+
+  for (i = 0;i < mat->n_cols;i++)
+    close(d_fds[i]);
+  for (i = 0;i < mat->n_rows;i++) {
+    if (-1 != c_fds[i])
+      close(c_fds[i]);
+  }
+  return ret;
+}
+
+/** 
+ * pick the fragments to decode from, every data available then enough
+ * codings, and get the inverse of the matching a_prime from the decode
+ * matrix cache or by inverting it. Codings that depend on the fragments
+ * already picked, like the local parity of a group whose data are all
+ * there, are passed over.
+ * 
+ * @param mat encoding matrix
+ * @param d_fds data fragments, -1 if missing
+ * @param c_fds coding fragments, -1 if missing
+ * @param rows filled with the n_cols fragments used: i < n_cols for data i,
+ *   n_cols + i for coding i
+ * 
+ * @return the inverse of a_prime, the caller must free it, or NULL if the
+ *   fragments available are not enough to decode
+ */
+t_mat *decode_matrix(t_mat *mat, int *d_fds, int *c_fds, int *rows)
+{
+  u_char bitmap[(mat->n_rows + mat->n_cols + 7) / 8];
+  t_gf_elt unit[mat->n_cols];
+  int pivots[mat->n_cols];
+  t_mat *basis;
+  t_mat *a_prime;
+  int i, k;
+
+  memset(bitmap, 0, sizeof (bitmap));
+  memset(unit, 0, sizeof (unit));
+  basis = mat_xcalloc(mat->n_cols, mat->n_cols);
+  k = 0;
+  for (i = 0;i < mat->n_cols;i++) {
+    if (-1 != d_fds[i]) {
+      unit[i] = 1;
+      k += mat_add_independent(basis, pivots, k, unit);
+      unit[i] = 0;
+      rows[k - 1] = i;
+      bitmap[i / 8] |= 1 << (i % 8);
+    }
+  }
+  for (i = 0;i < mat->n_rows && k < mat->n_cols;i++) {
+    if (-1 != c_fds[i] &&
+        mat_add_independent(basis, pivots, k, &MAT_ITEM(mat, i, 0))) {
+      rows[k++] = mat->n_cols + i;
+      bitmap[(mat->n_cols + i) / 8] |= 1 << ((mat->n_cols + i) % 8);
+    }
+  }
+  mat_free(basis);
+  if (k < mat->n_cols)
+    return NULL;
+
+  if (NULL == (a_prime = dcache_get(mat, bitmap))) {
+    if (NULL == (a_prime = mat_a_prime(mat, rows)))
+      xperror("malloc");
+    if (vflag) {
+      fprintf(stderr, "rebuild matrix:\n");
+      mat_dump(a_prime);
+    }
+    if (0 != mat_inv_a_prime(a_prime, rows))
+      xmsg("cannot invert", "rebuild matrix");
+    dcache_put(mat, bitmap, a_prime);
+  } else if (vflag) {
+    fprintf(stderr, "decode matrix found in cache\n");
+  }
+  return a_prime;
+}
+
+/*
+ * plan the repair of lost fragments from local groups only. A coding row
+ * of 0s and 1s is the XOR of a group of data, so each fragment of the
+ * group, its parity included, is the XOR of the others. For each lost
+ * fragment the smallest group whose other fragments are all usable is
+ * picked. rows is filled with the fragments to read, numbered as in
+ * mat_a_prime, and the matrix returned rebuilds the lost fragments from
+ * them, one column per entry of rows. NULL if some lost fragment is in no
+ * such group, or if the groups would read more than the n_cols fragments
+ * of a decode.
+ */
+static t_mat *local_repair(t_mat *mat, u_char *usable, int *lost, int n_lost,
+                           int *rows)
+{
+  int n = mat->n_cols + mat->n_rows;
+  int group[n_lost];
+  int idx[n];
+  int i, j, l, f, p, best, n_best, n_in;
+  t_mat *rep;
+
+  for (f = 0;f < n;f++)
+    idx[f] = -1;
+  n_in = 0;
+  for (l = 0;l < n_lost;l++) {
+    f = lost[l];
+    best = -1;
+    n_best = 0;
+    for (i = 0;i < mat->n_rows;i++) {
+      p = mat->n_cols + i;
+      if ((f < mat->n_cols) ? 1 != MAT_ITEM(mat, i, f) : f != p)
+        continue ;
+      if (f != p && !usable[p])
+        continue ;
+      for (j = 0;j < mat->n_cols;j++) {
+        if (0 != MAT_ITEM(mat, i, j) &&
+            (1 != MAT_ITEM(mat, i, j) || (j != f && !usable[j])))
+          break ;
+      }
+      if (j < mat->n_cols)
+        continue ;
+      for (j = 0, p = 0;j < mat->n_cols;j++)
+        p += MAT_ITEM(mat, i, j);
+      if (-1 == best || p < n_best) {
+        best = i;
+        n_best = p;
+      }
+    }
+    if (-1 == best)
+      return NULL;
+    group[l] = best;
+    for (j = 0;j <= mat->n_cols;j++) {
+      //the data of the group, then its parity
+      p = (j < mat->n_cols) ? j : mat->n_cols + best;
+      if (p == f || -1 != idx[p] ||
+          (j < mat->n_cols && 0 == MAT_ITEM(mat, best, j)))
+        continue ;
+      if (n_in == mat->n_cols)
+        return NULL;
+      idx[p] = n_in;
+      rows[n_in++] = p;
+    }
+  }
+
+  rep = mat_xcalloc(n_lost, n_in);
+  for (l = 0;l < n_lost;l++) {
+    for (j = 0;j <= mat->n_cols;j++) {
+      p = (j < mat->n_cols) ? j : mat->n_cols + group[l];
+      if (p != lost[l] &&
+          (j == mat->n_cols || 0 != MAT_ITEM(mat, group[l], j)))
+        MAT_ITEM(rep, l, idx[p]) = 1;
+    }
+  }
+  return rep;
+}
+
+/*
+ * block repair state shared by the workers, fragment f being data f for
+ * f < n_cols and coding f - n_cols otherwise
+ */
+typedef struct s_blocks
+{
+  t_mat *mat;
+  char **names;
+  int *fds;
+  u_char *missing;    /* fragments recreated empty */
+  u_char *skip;       /* fragments not read while local groups do */
+  u_int32_t **crcs;   /* CRC32C of each block of every fragment */
+  u_char *checked;    /* crcs[f] loaded from a sidecar */
+  u_char *dirty;      /* fragments with blocks rewritten */
+  size_t size;
+  size_t next;        /* offset of the next block to hand out */
+  int failed;         /* some block had too many erasures */
+  pthread_mutex_t lock;
+} t_blocks;
+
+/*
+ * read block b of fragment f, unless it lies in a hole, and check it
+ * against its sidecar. zero is set if the block is all zeros.
+ */
+static int ec_read_block(t_blocks *bl, int f, u_char *buf, size_t len,
+                         size_t off, u_int32_t *crc, u_char *zero)
+{
+  if (fd_is_hole(bl->fds[f], off, len)) {
+    memset(buf, 0, len);
+    *crc = crc32c_zeros(len);
+    *zero = 1;
+  } else {
+    ec_pread(bl->fds[f], buf, len, off);
+    *crc = crc32c(0, buf, len);
+    *zero = mem_is_zero(buf, len);
+  }
+  if (bl->checked[f] && *crc != bl->crcs[f][off / EC_BLOCK_SIZE]) {
+    if (vflag)
+      fprintf(stderr, "%s: bad block at offset %llu\n", bl->names[f],
+              (unsigned long long) off);
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * block repair worker: read a block of every fragment not skipped, erase
+ * the missing ones and those whose CRC32C does not match their sidecar,
+ * rebuild the erased from their local groups if they can, otherwise read
+ * the skipped fragments too and decode from n_cols of them, and write
+ * them back. The repair matrix is kept from one block to the next while
+ * the erasures are the same.
+ */
+static void *ec_block_worker(void *arg)
+{
+  t_blocks *bl = arg;
+  t_mat *mat = bl->mat;
+  int n = mat->n_cols + mat->n_rows;
+  u_char *bufs[n];
+  u_int32_t crcs[n];
+  u_char bad[n];
+  u_char unread[n];
+  u_char usable[n];
+  u_char cur[n];
+  u_char cur_unread[n];
+  u_char zero[n];
+  int d_fds[mat->n_cols];
+  int c_fds[mat->n_rows];
+  int rows[mat->n_cols];
+  int lost[n];
+  u_char *in[mat->n_cols];
+  u_char *out[n];
+  t_mat *a_prime;
+  t_mat *rep = NULL;
+  t_bitmat *bm = NULL;
+  size_t off, len, b;
+  int f, k, n_lost, n_unread;
+
+  for (f = 0;f < n;f++)
+    bufs[f] = pool_get();
+
+  while (1) {
+    pthread_mutex_lock(&bl->lock);
+    off = bl->next;
+    bl->next += EC_BLOCK_SIZE;
+    pthread_mutex_unlock(&bl->lock);
+    if (off >= bl->size)
+      break ;
+    len = bl->size - off;
+    if (len > EC_BLOCK_SIZE)
+      len = EC_BLOCK_SIZE;
+    b = off / EC_BLOCK_SIZE;
+
+    n_lost = n_unread = 0;
+    for (f = 0;f < n;f++) {
+      bad[f] = bl->missing[f];
+      unread[f] = bl->skip[f];
+      n_unread += unread[f];
+      if (!bad[f] && !unread[f] &&
+          0 != ec_read_block(bl, f, bufs[f], len, off, &crcs[f], &zero[f]))
+        bad[f] = 1;
+      if (bad[f])
+        lost[n_lost++] = f;
+    }
+  retry:
+    if (0 == n_lost)
+      goto next;
+    if (n_lost > mat->n_rows) {
+      fprintf(stderr, "too many losses at offset %llu\n",
+              (unsigned long long) off);
+      pthread_mutex_lock(&bl->lock);
+      bl->failed = 1;
+      pthread_mutex_unlock(&bl->lock);
+      continue ;
+    }
+
+    if (NULL == rep || 0 != memcmp(cur, bad, n) ||
+        0 != memcmp(cur_unread, unread, n)) {
+      mat_free(rep);
+      bitmat_free(bm);
+      bm = NULL;
+      for (f = 0;f < n;f++)
+        usable[f] = !bad[f] && !unread[f];
+      if (NULL == (rep = local_repair(mat, usable, lost, n_lost, rows))) {
+        if (n_unread > 0) {
+          //the groups do not do, read the rest
+          for (f = 0;f < n;f++) {
+            if (!unread[f])
+              continue ;
+            unread[f] = 0;
+            if (0 != ec_read_block(bl, f, bufs[f], len, off, &crcs[f],
+                                   &zero[f])) {
+              bad[f] = 1;
+              lost[n_lost++] = f;
+            }
+          }
+          n_unread = 0;
+          goto retry;
+        }
+        for (f = 0;f < n;f++) {
+          if (f < mat->n_cols)
+            d_fds[f] = bad[f] ? -1 : bl->fds[f];
+          else
+            c_fds[f - mat->n_cols] = bad[f] ? -1 : bl->fds[f];
+        }
+        //the decode matrix cache is shared
+        pthread_mutex_lock(&bl->lock);
+        a_prime = decode_matrix(mat, d_fds, c_fds, rows);
+        pthread_mutex_unlock(&bl->lock);
+        if (NULL == a_prime) {
+          fprintf(stderr, "too many losses at offset %llu\n",
+                  (unsigned long long) off);
+          pthread_mutex_lock(&bl->lock);
+          bl->failed = 1;
+          pthread_mutex_unlock(&bl->lock);
+          continue ;
+        }
+        if (NULL == (rep = mat_repair(mat, a_prime, lost, n_lost)))
+          xperror("malloc");
+        mat_free(a_prime);
+      }
+      if (xflag && NULL == (bm = bitmat_create(rep)))
+        xperror("malloc");
+      memcpy(cur, bad, n);
+      memcpy(cur_unread, unread, n);
+    }
+
+    //the erased blocks of a block of zeros are zeros, left as holes
+    for (k = 0;k < rep->n_cols && zero[rows[k]];k++)
+      ;
+    if (k == rep->n_cols) {
+      for (k = 0;k < n_lost;k++) {
+        f = lost[k];
+        ec_write_zero(bl->fds[f], bufs[f], len, off);
+        crcs[f] = crc32c_zeros(len);
+      }
+    } else {
+      for (k = 0;k < rep->n_cols;k++)
+        in[k] = bufs[rows[k]];
+      for (k = 0;k < n_lost;k++)
+        out[k] = bufs[lost[k]];
+      if (NULL != bm)
+        bitmat_mult_region(bm, in, out, len, NULL);
+      else
+        mat_mult_region(rep, in, out, len);
+      for (k = 0;k < n_lost;k++) {
+        f = lost[k];
+        xpwrite(bl->fds[f], bufs[f], dflag ? EC_DIRECT_ROUND(len) : len,
+                off);
+        crcs[f] = crc32c(0, bufs[f], len);
+      }
+    }
+    pthread_mutex_lock(&bl->lock);
+    for (k = 0;k < n_lost;k++)
+      bl->dirty[lost[k]] = 1;
+    pthread_mutex_unlock(&bl->lock);
+  next:
+    for (f = 0;f < n;f++) {
+      if (!unread[f])
+        bl->crcs[f][b] = crcs[f];
+    }
+  }
+
+  mat_free(rep);
+  bitmat_free(bm);
+  for (f = 0;f < n;f++)
+    pool_put(bufs[f]);
+  return NULL;
+}
+
+/*
+ * repair block by block the fragments of bl: the missing ones entirely,
+ * the others where their CRC32C does not match their sidecar, then store
+ * the sidecars of the fragments rewritten or without one. When the
+ * missing fragments can all be rebuilt from their local groups, only
+ * the groups and the fragments without a sidecar are read.
+ */
+static int ec_repair_blocks(t_blocks *bl)
+{
+  t_mat *mat = bl->mat;
+  int n = n_threads;
+  pthread_t threads[n];
+  size_t n_blocks = EC_N_BLOCKS(bl->size);
+  int n_frags = mat->n_cols + mat->n_rows;
+  u_char usable[n_frags];
+  int lost[n_frags];
+  int rows[mat->n_cols];
+  t_mat *rep = NULL;
+  int f, i, n_lost = 0;
+
+  for (f = 0;f < n_frags;f++) {
+    usable[f] = !bl->missing[f];
+    if (bl->missing[f])
+      lost[n_lost++] = f;
+    bl->skip[f] = 0;
+  }
+  if (n_lost > 0 &&
+      NULL != (rep = local_repair(mat, usable, lost, n_lost, rows))) {
+    for (f = 0;f < n_frags;f++)
+      bl->skip[f] = bl->checked[f];
+    for (i = 0;i < rep->n_cols;i++)
+      bl->skip[rows[i]] = 0;
+    if (vflag)
+      fprintf(stderr, "repairing from local groups of %d fragments\n",
+              rep->n_cols);
+    mat_free(rep);
+  }
+
+  bl->next = 0;
+  bl->failed = 0;
+  pthread_mutex_init(&bl->lock, NULL);
+
+  if (n > n_blocks)
+    n = n_blocks;
+  if (n <= 1) {
+    ec_block_worker(bl);
+  } else {
+    for (i = 0;i < n;i++) {
+      if (0 != (errno = pthread_create(&threads[i], NULL, ec_block_worker,
+                                       bl)))
+        xperror("pthread_create");
+    }
+    for (i = 0;i < n;i++)
+      pthread_join(threads[i], NULL);
+  }
+  pthread_mutex_destroy(&bl->lock);
+
+  for (f = 0;f < mat->n_cols + mat->n_rows;f++) {
+    if (!bl->dirty[f])
+      continue ;
+    //the fragments recreated may end on a hole
+    if ((dflag || bl->missing[f]) && -1 == ftruncate(bl->fds[f], bl->size))
+      xperror("ftruncate");
+    if (vflag && !bl->missing[f])
+      fprintf(stderr, "%s repaired\n", bl->names[f]);
+  }
+  if (bl->failed)
+    return -1;
+  for (f = 0;f < mat->n_cols + mat->n_rows;f++) {
+    if (bl->dirty[f] || !bl->checked[f])
+      crc_store(bl->names[f], bl->crcs[f], n_blocks);
+  }
+  return 0;
+}
+
+/** 
+ * repair missing data and coding files
+ *
+ * Only the lost fragments are computed, in a single pass over k surviving
+ * fragments: the row of the inverse of a_prime for each lost data, and
+ * the encoding row times the inverse for each lost coding.
+ *
+ * Fragments with checksum sidecars are all read instead and repaired
+ * block by block, the blocks whose CRC32C does not match being erased
+ * like the missing files, so that silently corrupted data is neither
+ * used to decode nor left in place.
+ *
+ * Under -P the lost fragments are rebuilt by a chain of helper processes
+ * instead, one per fragment read, and the sidecars are not checked.
  * 
  * @param prefix prefix of files 
- * @param mat 
+ * @param mat encoding matrix
  */
 int repair_data_files(char *prefix, t_mat *mat)
 {
-  int i, j, k;
-  FILE *d_files[mat->n_cols];
-  FILE *r_files[mat->n_cols];
-  FILE *c_files[mat->n_rows];
+  int n = mat->n_cols + mat->n_rows;
+  int i, k, f;
+  int d_fds[mat->n_cols];
+  int r_fds[mat->n_cols];
+  int c_fds[mat->n_rows];
+  int rc_fds[mat->n_rows];
+  int in_fds[mat->n_cols];
+  int out_fds[mat->n_cols + mat->n_rows];
+  int lost[mat->n_cols + mat->n_rows];
+  int rows[mat->n_cols];
   char filename[1024];
   struct stat stbuf;
-  size_t size = -1, wc;
+  size_t size = -1;
   t_mat *a_prime = NULL;
+  t_mat *rep = NULL;
+  int n_lost;
   u_int n_data_ok = 0;
   u_int n_coding_ok = 0;
-  u_int n_total_ok;
-  t_vec *words = NULL;
-  t_vec *output = NULL;
+  char *names[n];
+  int fds[n];
+  u_char missing[n];
+  u_char usable[n];
+  u_char skip[n];
+  u_char checked[n];
+  u_char dirty[n];
+  u_int32_t *crcs[n];
+  u_int32_t *out_crcs[n];
+  size_t n_blocks;
+  int n_checked;
+  t_blocks bl;
   int ret;
   
   for (i = 0;i < mat->n_cols;i++) {
     snprintf(filename, sizeof (filename), "%s.d%d", prefix, i);
+    names[i] = xstrdup(filename);
     if (-1 == access(filename, F_OK)) {
       if (vflag)
         fprintf(stderr, "%s is missing\n", filename);
-      d_files[i] = NULL;
-      if (NULL == (r_files[i] = fopen(filename, "w")))
-        xerrormsg("error opening", filename);
+      d_fds[i] = r_fds[i] = -1;
     } else {
-      r_files[i] = NULL;
-      if (NULL == (d_files[i] = fopen(filename, "r")))
+      r_fds[i] = -1;
+      //checked blocks may have to be rewritten in place
+      if (-1 == (d_fds[i] = ec_open(filename, crc_exists(filename) ? O_RDWR :
+                                    O_RDONLY, 0)))
         xerrormsg("error opening", filename);
-      if (-1 == fstat(fileno(d_files[i]), &stbuf))
+      if (-1 == fstat(d_fds[i], &stbuf))
         xerrormsg("error stating", filename);
       if (-1 == size)
         size = stbuf.st_size;
@@ -127,124 +1353,417 @@ int repair_data_files(char *prefix, t_mat *mat)
   
   for (i = 0;i < mat->n_rows;i++) {
     snprintf(filename, sizeof (filename), "%s.c%d", prefix, i);
+    names[mat->n_cols + i] = xstrdup(filename);
     if (access(filename, F_OK)) {
       if (vflag)
         fprintf(stderr, "%s is missing\n", filename);
-      c_files[i] = NULL;
+      c_fds[i] = rc_fds[i] = -1;
     } else {
-      if (NULL == (c_files[i] = fopen(filename, "r")))
+      rc_fds[i] = -1;
+      if (-1 == (c_fds[i] = ec_open(filename, crc_exists(filename) ? O_RDWR :
+                                    O_RDONLY, 0)))
         xerrormsg("error opening", filename);
+      if (-1 == fstat(c_fds[i], &stbuf))
+        xerrormsg("error stating", filename);
+      //coding files only cover whole words of the data files
+      if (-1 == size)
+        size = stbuf.st_size;
+      else if (alignw(size) != stbuf.st_size)
+        xmsg("bad size", filename);
       n_coding_ok++;
     }
   }
 
-  if (n_data_ok == mat->n_cols) {
-    ret = 0;
-    goto end;
+  n_blocks = EC_N_BLOCKS(alignw(size));
+  n_checked = 0;
+  n_lost = 0;
+  for (f = 0;f < n;f++) {
+    missing[f] = (-1 == ((f < mat->n_cols) ? d_fds[f] :
+                         c_fds[f - mat->n_cols]));
+    if (missing[f])
+      lost[n_lost++] = f;
+    usable[f] = !missing[f];
+    crcs[f] = missing[f] ? NULL : crc_load(names[f], n_blocks);
+    checked[f] = (NULL != crcs[f]);
+    n_checked += checked[f];
+    dirty[f] = 0;
   }
 
-  if (n_coding_ok < (mat->n_cols-n_data_ok)) {
+  //a group is cheaper than a decode when it has all its other fragments.
+  //Nothing is created unless the missing fragments can be rebuilt.
+  if (n_lost > 0 &&
+      NULL == (rep = local_repair(mat, usable, lost, n_lost, rows)) &&
+      NULL == (a_prime = decode_matrix(mat, d_fds, c_fds, rows))) {
     fprintf(stderr, "too many losses\n");
     ret = -1;
     goto end;
   }
 
-  n_total_ok = n_data_ok + n_coding_ok;
-  if (vflag)
-    fprintf(stderr, "n_data_ok=%d n_coding_ok=%d\n", n_data_ok, n_coding_ok);
-
-  //generate a_prime
-  a_prime = mat_xcalloc(n_total_ok, mat->n_cols);
-  //for each data available generate the corresponding identity
-  k = 0;
-  for (i = 0;i < mat->n_cols;i++) {
-    if (NULL != d_files[i]) {
-      for (j = 0;j < mat->n_cols;j++) {
-        if (i == j)
-          MAT_ITEM(a_prime, k, j) = 1;
-        else
-          MAT_ITEM(a_prime, k, j) = 0;
-      }
-      k++;
+  for (f = 0;f < n;f++) {
+    if (!missing[f]) {
+      fds[f] = (f < mat->n_cols) ? d_fds[f] : c_fds[f - mat->n_cols];
+      continue ;
     }
+    if (-1 == (fds[f] = ec_open(names[f], O_RDWR|O_CREAT|O_TRUNC, 0666)))
+      xerrormsg("error opening", names[f]);
+    if (f < mat->n_cols)
+      r_fds[f] = fds[f];
+    else
+      rc_fds[f - mat->n_cols] = fds[f];
   }
-  //finish the matrix with every coding available
-  for (i = 0;i < mat->n_rows;i++) {
-    if (NULL != c_files[i]) {
-      //copy corresponding row in vandermonde matrix
-      for (j = 0;j < mat->n_cols;j++) {
-        MAT_ITEM(a_prime, k, j) = MAT_ITEM(mat, i, j);
-      }
-      k++;
-      //stop when we have enough codings
-      if (mat->n_cols == k)
-        break ;
+
+  //the chain does not read every fragment to check it
+  if (n_checked > 0 && !pflag) {
+    for (f = 0;f < n;f++) {
+      if (NULL == crcs[f])
+        crcs[f] = xmalloc((n_blocks + 1) * sizeof (u_int32_t));
     }
+    bl.mat = mat;
+    bl.names = names;
+    bl.fds = fds;
+    bl.missing = missing;
+    bl.skip = skip;
+    bl.crcs = crcs;
+    bl.checked = checked;
+    bl.dirty = dirty;
+    bl.size = alignw(size);
+    ret = ec_repair_blocks(&bl);
+    goto end;
   }
 
-  if (vflag) {
-    fprintf(stderr, "rebuild matrix:\n");
-    mat_dump(a_prime);
+  if (n_data_ok == mat->n_cols && n_coding_ok == mat->n_rows) {
+    ret = 0;
+    goto end;
   }
 
-  mat_inv(a_prime);
+  if (vflag)
+    fprintf(stderr, "n_data_ok=%d n_coding_ok=%d\n", n_data_ok, n_coding_ok);
 
-  //read-and-repair
-  words = vec_xcalloc(mat->n_cols);
-  output = vec_xcalloc(mat->n_cols);
-  
-  for (i = 0;i < sizew(size);i++) {
-    vec_zero(words);
-    k = 0;
-    for (j = 0;j < mat->n_cols;j++) {
-      if (NULL != d_files[j]) {
-        wc = freadw(&VEC_ITEM(words, k), d_files[j]);
-        if (1 != wc)
-          xperror("short read data");
-        k++;
-      }
-    }
-    for (j = 0;j < mat->n_rows;j++) {
-      if (NULL != c_files[j]) {
-        wc = freadw(&VEC_ITEM(words, k), c_files[j]);
-        if (1 != wc)
-          xperror("short read coding");
-        k++;
-        //stop when we have enough codings
-        if (mat->n_cols == k)
-          break ;
-      }
-    }
+  //keep only the rows producing the lost fragments
+  for (k = 0;k < n_lost;k++)
+    out_fds[k] = fds[lost[k]];
+  if (NULL != rep) {
+    if (vflag)
+      fprintf(stderr, "repairing from local groups of %d fragments\n",
+              rep->n_cols);
+  } else if (NULL == (rep = mat_repair(mat, a_prime, lost, n_lost))) {
+    xperror("malloc");
+  }
+  for (k = 0;k < rep->n_cols;k++) {
+    if (rows[k] < mat->n_cols)
+      in_fds[k] = d_fds[rows[k]];
+    else
+      in_fds[k] = c_fds[rows[k] - mat->n_cols];
+  }
 
-    mat_mult(output, a_prime, words);
+  if (vflag) {
+    fprintf(stderr, "repair matrix:\n");
+    mat_dump(rep);
+  }
 
-    for (j = 0;j < mat->n_cols;j++) {
-      if (NULL != r_files[j]) {
-        wc = fwritew(& VEC_ITEM(output, j), r_files[j]);
-        if (1 != wc)
-          xperror("short write coding");
-      }
+  if (pflag) {
+    //the rebuilt fragments get sidecars if the others have
+    for (k = 0;k < n_lost && n_checked > 0;k++) {
+      crcs[lost[k]] = xmalloc((n_blocks + 1) * sizeof (u_int32_t));
+      out_crcs[k] = crcs[lost[k]];
     }
-  } 
+    ret = chain_repair(rep, in_fds, out_fds, size,
+                       (n_checked > 0) ? out_crcs : NULL);
+    for (k = 0;k < n_lost && n_checked > 0 && 0 == ret;k++)
+      crc_store(names[lost[k]], crcs[lost[k]], n_blocks);
+    goto end;
+  }
+
+  //read-and-repair
+  ec_apply(rep, in_fds, out_fds, size, NULL, NULL);
    
   ret = 0;
  end:
   for (i = 0;i < mat->n_cols;i++) {
-    if (NULL != d_files[i])
-      fclose(d_files[i]);
-    if (NULL != r_files[i])
-      fclose(r_files[i]);
+    if (-1 != d_fds[i])
+      close(d_fds[i]);
+    if (-1 != r_fds[i])
+      close(r_fds[i]);
   }
   
   for (i = 0;i < mat->n_rows;i++) {
-    if (NULL != c_files[i])
-      fclose(c_files[i]);
+    if (-1 != c_fds[i])
+      close(c_fds[i]);
+    if (-1 != rc_fds[i])
+      close(rc_fds[i]);
+  }
+
+  for (f = 0;f < n;f++) {
+    free(names[f]);
+    free(crcs[f]);
   }
 
-  vec_free(words);
-  vec_free(output);
   mat_free(a_prime);
+  mat_free(rep);
 
   return ret;
 }
 
+/** 
+ * apply a partial overwrite of data file index to the coding files:
+ * c_i ^= mat[i][index] * (old ^ new) over the overwritten range only,
+ * then store the new contents into the data file
+ * 
+ * @param prefix prefix of files
+ * @param mat encoding matrix
+ * @param index data file being overwritten
+ * @param offset offset of the overwrite in the data file
+ * @param new_path file holding the new contents
+ * @param old_path file holding the old contents, or NULL to read them from
+ *   the data file
+ */
+void update_coding_files(char *prefix, t_mat *mat, int index, off_t offset,
+                         char *new_path, char *old_path)
+{
+  int i;
+  int d_fd, n_fd, o_fd;
+  int c_fds[mat->n_rows];
+  char filename[1024];
+  struct stat stbuf;
+  size_t size, dsize, off, len;
+  u_char *delta, *buf, *coding;
+
+  if (index < 0 || index >= mat->n_cols)
+    xmsg("bad data index", "");
+
+  if (-1 == (n_fd = open(new_path, O_RDONLY)))
+    xerrormsg("error opening", new_path);
+  if (-1 == fstat(n_fd, &stbuf))
+    xerrormsg("error stating", new_path);
+  size = stbuf.st_size;
+  snprintf(filename, sizeof (filename), "%s.d%d", prefix, index);
+  if (-1 == (d_fd = open(filename, O_RDWR)))
+    xerrormsg("error opening", filename);
+  if (-1 == fstat(d_fd, &stbuf))
+    xerrormsg("error stating", filename);
+  dsize = alignw(stbuf.st_size);
+  if (offset < 0 || offset + size > dsize)
+    xmsg("update out of range of", filename);
+  if (alignw(offset) != offset || alignw(size) != size)
+    xmsg("update not aligned on words", new_path);
+  if (NULL == old_path) {
+    o_fd = d_fd;
+  } else if (-1 == (o_fd = open(old_path, O_RDONLY))) {
+    xerrormsg("error opening", old_path);
+  }
+
+  for (i = 0;i < mat->n_rows;i++) {
+    snprintf(filename, sizeof (filename), "%s.c%d", prefix, i);
+    if (-1 == (c_fds[i] = open(filename, O_RDWR)))
+      xerrormsg("error opening", filename);
+  }
+
+  delta = xmalloc(EC_BLOCK_SIZE);
+  buf = xmalloc(EC_BLOCK_SIZE);
+  coding = xmalloc(EC_BLOCK_SIZE);
+
+  for (off = 0;off < size;off += len) {
+    len = size - off;
+    if (len > EC_BLOCK_SIZE)
+      len = EC_BLOCK_SIZE;
+    //delta = old ^ new
+    xpread(o_fd, delta, len, (NULL == old_path) ? offset + off : off);
+    xpread(n_fd, buf, len, off);
+    gf_region_mul_xor(delta, buf, 1, len);
+    for (i = 0;i < mat->n_rows;i++) {
+      xpread(c_fds[i], coding, len, offset + off);
+      gf_region_mul_xor(coding, delta, MAT_ITEM(mat, i, index), len);
+      xpwrite(c_fds[i], coding, len, offset + off);
+    }
+    //parity is up to date, now overwrite the data
+    xpwrite(d_fd, buf, len, offset + off);
+  }
+
+  //bring the checksums of the blocks touched up to date
+  snprintf(filename, sizeof (filename), "%s.d%d", prefix, index);
+  crc_refresh(filename, d_fd, dsize, offset, size);
+  for (i = 0;i < mat->n_rows;i++) {
+    snprintf(filename, sizeof (filename), "%s.c%d", prefix, i);
+    crc_refresh(filename, c_fds[i], dsize, offset, size);
+  }
+
+  free(delta);
+  free(buf);
+  free(coding);
+
+  for (i = 0;i < mat->n_rows;i++)
+    close(c_fds[i]);
+  if (NULL != old_path)
+    close(o_fd);
+  close(n_fd);
+  close(d_fd);
+}
+
+/** 
+ * degraded read: write to stdout length bytes at offset of data file
+ * index. If the file is missing, only that range is read from n_cols
+ * other fragments and decoded through the row of the repair matrix of
+ * the file, nothing being rebuilt.
+ * 
+ * @param prefix prefix of files
+ * @param mat encoding matrix
+ * @param index data file to read
+ * @param offset offset of the range
+ * @param length length of the range, cut at the end of the file
+ * 
+ * @return 0 on success, -1 if too many fragments are missing or if the
+ *   range reaches the odd tail byte of a missing file, which the coding
+ *   files do not cover
+ */
+int read_range(char *prefix, t_mat *mat, int index, off_t offset,
+               size_t length)
+{
+  int i, k;
+  int d_fds[mat->n_cols];
+  int c_fds[mat->n_rows];
+  int in_fds[mat->n_cols];
+  int rows[mat->n_cols];
+  u_char *in[mat->n_cols];
+  u_char usable[mat->n_cols + mat->n_rows];
+  u_char *out;
+  char filename[1024];
+  struct stat stbuf;
+  size_t size = -1;
+  size_t unit, start, end, off, len, skip;
+  t_mat *a_prime = NULL;
+  t_mat *rep = NULL;
+  t_bitmat *bm = NULL;
+  struct iovec iov;
+  u_int n_ok = 0;
+  int ret = 0;
+
+  if (index < 0 || index >= mat->n_cols)
+    xmsg("bad data index", "");
+
+  for (i = 0;i < mat->n_cols + mat->n_rows;i++) {
+    if (i < mat->n_cols)
+      snprintf(filename, sizeof (filename), "%s.d%d", prefix, i);
+    else
+      snprintf(filename, sizeof (filename), "%s.c%d", prefix,
+               i - mat->n_cols);
+    if (-1 == (k = open(filename, O_RDONLY))) {
+      if (ENOENT != errno)
+        xerrormsg("error opening", filename);
+      if (vflag)
+        fprintf(stderr, "%s is missing\n", filename);
+    } else {
+      if (-1 == fstat(k, &stbuf))
+        xerrormsg("error stating", filename);
+      //the data files come first, coding files only cover their words
+      if (-1 == size)
+        size = stbuf.st_size;
+      else if ((i < mat->n_cols) ? size != stbuf.st_size :
+               alignw(size) != stbuf.st_size)
+        xmsg("bad size", filename);
+      n_ok++;
+    }
+    if (i < mat->n_cols)
+      d_fds[i] = k;
+    else
+      c_fds[i - mat->n_cols] = k;
+  }
+  if (n_ok < mat->n_cols) {
+    fprintf(stderr, "too many losses\n");
+    ret = -1;
+    goto end;
+  }
+  if (offset < 0 || offset > size)
+    xmsg("read out of range of", prefix);
+  if (length > size - offset)
+    length = size - offset;
+
+  out = xmalloc(EC_BLOCK_SIZE);
+
+  if (-1 != d_fds[index]) {
+    for (off = offset;off < offset + length;off += len) {
+      len = offset + length - off;
+      if (len > EC_BLOCK_SIZE)
+        len = EC_BLOCK_SIZE;
+      xpread(d_fds[index], out, len, off);
+      iov.iov_base = out;
+      iov.iov_len = len;
+      xwritev(1, &iov, 1);
+    }
+    free(out);
+    goto end;
+  }
+
+  if (offset + length > alignw(size)) {
+    fprintf(stderr, "%s.d%d: the last byte is not covered by the coding "
+            "files\n", prefix, index);
+    free(out);
+    ret = -1;
+    goto end;
+  }
+
+  //from the local group of the fragment if it has one
+  for (i = 0;i < mat->n_cols + mat->n_rows;i++)
+    usable[i] = -1 != ((i < mat->n_cols) ? d_fds[i] : c_fds[i - mat->n_cols]);
+  if (NULL == (rep = local_repair(mat, usable, &index, 1, rows))) {
+    if (NULL == (a_prime = decode_matrix(mat, d_fds, c_fds, rows))) {
+      fprintf(stderr, "too many losses\n");
+      free(out);
+      ret = -1;
+      goto end;
+    }
+    if (NULL == (rep = mat_repair(mat, a_prime, &index, 1)))
+      xperror("malloc");
+  }
+  for (k = 0;k < rep->n_cols;k++) {
+    if (rows[k] < mat->n_cols)
+      in_fds[k] = d_fds[rows[k]];
+    else
+      in_fds[k] = c_fds[rows[k] - mat->n_cols];
+    in[k] = xmalloc(EC_BLOCK_SIZE);
+  }
+  if (xflag && NULL == (bm = bitmat_create(rep)))
+    xperror("malloc");
+
+  //widen the range to whole words, or whole chunks under -X, the last
+  //one being cut at the end of the fragments as when encoding
+  unit = (NULL != bm) ? bm->w * EC_PACKET_SIZE : (get_w() + 7) / 8;
+  start = offset / unit * unit;
+  end = (offset + length + unit - 1) / unit * unit;
+  if (end > alignw(size))
+    end = alignw(size);
+
+  for (off = start;off < end;off += len) {
+    len = end - off;
+    if (len > EC_BLOCK_SIZE)
+      len = EC_BLOCK_SIZE;
+    for (k = 0;k < rep->n_cols;k++)
+      xpread(in_fds[k], in[k], len, off);
+    if (NULL != bm)
+      bitmat_mult_region(bm, in, &out, len, NULL);
+    else
+      mat_mult_region(rep, in, &out, len);
+    skip = (off < offset) ? offset - off : 0;
+    iov.iov_base = out + skip;
+    iov.iov_len = len - skip;
+    if (off + len > offset + length)
+      iov.iov_len -= off + len - (offset + length);
+    xwritev(1, &iov, 1);
+  }
+
+  for (k = 0;k < rep->n_cols;k++)
+    free(in[k]);
+  free(out);
+ end:
+  for (i = 0;i < mat->n_cols;i++) {
+    if (-1 != d_fds[i])
+      close(d_fds[i]);
+  }
+  for (i = 0;i < mat->n_rows;i++) {
+    if (-1 != c_fds[i])
+      close(c_fds[i]);
+  }
+  bitmat_free(bm);
+  mat_free(a_prime);
+  mat_free(rep);
+  return ret;
+}
@@ -8,12 +8,35 @@
 #include <errno.h>
 #include <getopt.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <endian.h>
 
+#include "gf.h"
 #include "vec.h"
 #include "mat.h"
+#include "bitmat.h"
+#include "crc.h"
 #include "misc.h"
-#include "gf.h"
 #include "main.h"
+#include "dcache.h"
+#include "stream.h"
+#include "batch.h"
+#include "chain.h"
+#include "daemon.h"
+#include "pool.h"
+#include "libec.h"
+
+/* size of the per-fragment buffers used by the coding loops */
+#define EC_BLOCK_SIZE (1024 * 1024)
+#define EC_N_BLOCKS(size) (((size) + EC_BLOCK_SIZE - 1) / EC_BLOCK_SIZE)
 
 extern void create_coding_files(char *prefix, t_mat *mat);
+extern int verify_coding_files(char *prefix, t_mat *mat);
+extern t_mat *decode_matrix(t_mat *mat, int *d_fds, int *c_fds, int *rows);
 extern int repair_data_files(char *prefix, t_mat *mat);
+extern void update_coding_files(char *prefix, t_mat *mat, int index,
+                                off_t offset, char *new_path, char *old_path);
+extern int read_range(char *prefix, t_mat *mat, int index, off_t offset,
+                      size_t length);
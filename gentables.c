@@ -0,0 +1,109 @@
+/**
+ * @file   gentables.c
+ *
+ * @brief  Build-time generator of the field tables and of the encoding
+ *         matrices of the common (n_data, n_coding) shapes. It is linked
+ *         against a bootstrap build of gf.c that computes them at run time
+ *         and prints them as C for the regular build of gf.c to include.
+ */
+
+#include "ec.h"
+
+extern unsigned short *gflog;
+extern unsigned short *gfilog;
+
+/* (n_data, n_coding) shapes whose matrices are generated */
+static int shapes[][2] = {
+  { 3, 3 }, { 4, 2 }, { 5, 3 }, { 6, 3 }, { 8, 3 }, { 8, 4 },
+  { 9, 3 }, { 9, 5 }, { 10, 4 }, { 12, 4 },
+};
+
+/*
+ * print n items as an array initializer, braced by rows of row items
+ * for a two dimensional array (row == n otherwise)
+ */
+static void print_array(char *decl, int n, int row, int (*item)(int i))
+{
+  int i;
+
+  printf("%s = {", decl);
+  for (i = 0;i < n;i++) {
+    if (row != n && 0 == i % row)
+      printf("%s\n  {", (0 == i) ? "" : "\n  },");
+    printf("%s%d,", (0 == i % 16) ? "\n  " : " ", item(i));
+  }
+  printf("%s\n};\n\n", (row != n) ? "\n  }," : "");
+}
+
+static int log_item(int i)
+{
+  return (0 == i) ? 0 : gflog[i];
+}
+
+static int ilog_item(int i)
+{
+  return (i == (1 << W) - 1) ? 0 : gfilog[i];
+}
+
+#if W == 4 || W == 8
+static int mul_item(int i)
+{
+  return gmul(i >> W, i & ((1 << W) - 1));
+}
+#endif
+
+static t_mat *cur_mat;
+
+static int mat_item(int i)
+{
+  return cur_mat->mem[i];
+}
+
+int main()
+{
+  char decl[256];
+  int s, type, n = 0;
+
+  if (0 != setup_tables())
+    xperror("setup_tables");
+
+  printf("/* generated by gentables for W=%d, do not edit */\n\n", W);
+  print_array("static const unsigned short gflog[NW]", 1 << W, 1 << W,
+              log_item);
+  print_array("static const unsigned short gfilog[NW]", 1 << W, 1 << W,
+              ilog_item);
+#if W == 4 || W == 8
+  printf("#define HAVE_GFMUL\n");
+  print_array("static const u_char gfmul[NW][NW]", 1 << (2 * W), 1 << W,
+              mul_item);
+#endif
+
+  for (s = 0;s < sizeof (shapes) / sizeof (shapes[0]);s++) {
+    if (0 != check_w(shapes[s][0] + shapes[s][1]))
+      continue ;
+    for (type = EC_MAT_VANDERMONDE;type <= EC_MAT_CAUCHY;type++) {
+      if (EC_MAT_CAUCHY == type)
+        cur_mat = mat_cauchy(shapes[s][1], shapes[s][0]);
+      else
+        cur_mat = mat_vandermonde_correct(shapes[s][1], shapes[s][0]);
+      if (NULL == cur_mat)
+        xperror("malloc");
+      snprintf(decl, sizeof (decl), "static const t_gf_elt gen_mat_%d[]", n++);
+      print_array(decl, cur_mat->n_rows * cur_mat->n_cols,
+                  cur_mat->n_rows * cur_mat->n_cols, mat_item);
+      mat_free(cur_mat);
+    }
+  }
+
+  printf("static const struct s_gen_mat gen_mats[] = {\n");
+  n = 0;
+  for (s = 0;s < sizeof (shapes) / sizeof (shapes[0]);s++) {
+    if (0 != check_w(shapes[s][0] + shapes[s][1]))
+      continue ;
+    for (type = EC_MAT_VANDERMONDE;type <= EC_MAT_CAUCHY;type++)
+      printf("  { %d, %d, %d, gen_mat_%d },\n", type, shapes[s][1],
+             shapes[s][0], n++);
+  }
+  printf("};\n");
+  return 0;
+}
@@ -1,49 +1,62 @@
 
 #include "ec.h"
+#if defined(__x86_64__) || defined(__i386__)
+# include <immintrin.h>
+# define HAVE_X86_SIMD
+#endif
 
 #ifndef W
 # error "please define W"
 #endif
 #define NW (1 << W)   /* In other words, NW equals 2 to the w-th power */
-#if W == 4
-# define SIZEW(size) ((size)*2)
-#elif W == 8
-# define SIZEW(size) (size)
-#elif W == 16
-# define SIZEW(size) ((size)/2)
-#endif
 
 u_int prim_poly_4 = 023;
 u_int prim_poly_8 = 0435;
 u_int prim_poly_16 = 0210013;
+
+/* encoding matrix generated at build time */
+struct s_gen_mat
+{
+  int type;         /* EC_MAT_VANDERMONDE or EC_MAT_CAUCHY */
+  u_int n_rows;
+  u_int n_cols;
+  const t_gf_elt *mem;
+};
+
+#ifdef GF_BOOTSTRAP
+/* computed by setup_tables, for gentables only */
 unsigned short *gflog = NULL;
 unsigned short *gfilog = NULL;
+static const struct s_gen_mat *gen_mats = NULL;
+# define N_GEN_MATS 0
+#else
+# if W == 4
+#  include "gftab4.h"
+# elif W == 8
+#  include "gftab8.h"
+# else
+#  include "gftab16.h"
+# endif
+# define N_GEN_MATS (sizeof (gen_mats) / sizeof (gen_mats[0]))
+#endif
 
-size_t sizew(size_t size)
-{
-  return SIZEW(size);
-}
+static void select_kernel();
 
-size_t freadw(void *ptr, FILE *stream)
+/* bytes of source split into nibbles at once by the multi-output kernels */
+#define MULTI_SUB 1024
+
+size_t alignw(size_t size)
 {
-#if W == 4
-  return 0; //TBD
-#elif W == 8
-  return fread(ptr, 1, 1, stream);
-#elif W == 16
-  return fread(ptr, 2, 1, stream);
+#if W == 16
+  return size & ~(size_t) 1;
+#else
+  return size;
 #endif
 }
 
-size_t fwritew(const void *ptr, FILE *stream)
+int get_w()
 {
-#if W == 4
-  return 0; //TBD
-#elif W == 8
-  return fwrite(ptr, 1, 1, stream);
-#elif W == 16
-  return fwrite(ptr, 2, 1, stream);
-#endif
+  return W;
 }
 
 int check_w(int n)
@@ -53,6 +66,7 @@ int check_w(int n)
   return 0;
 }
 
+#ifdef GF_BOOTSTRAP
 int setup_tables()
 {
   u_int b, log, x_to_w, prim_poly;
@@ -63,9 +77,17 @@ int setup_tables()
   case 16: prim_poly = prim_poly_16; break;
   default: return -1;
   }
+  if (NULL != gflog)
+    return 0;
   x_to_w = 1 << W;
-  gflog  = (unsigned short *) xmalloc (sizeof(unsigned short) * x_to_w);
-  gfilog = (unsigned short *) xmalloc (sizeof(unsigned short) * x_to_w);
+  gflog  = (unsigned short *) malloc (sizeof(unsigned short) * x_to_w);
+  gfilog = (unsigned short *) malloc (sizeof(unsigned short) * x_to_w);
+  if (NULL == gflog || NULL == gfilog) {
+    free(gflog);
+    free(gfilog);
+    gflog = gfilog = NULL;
+    return -1;
+  }
   b = 1;
   for (log = 0; log < x_to_w-1; log++) {
     gflog[b] = (unsigned short) log;
@@ -73,8 +95,41 @@ int setup_tables()
     b = b << 1;
     if (b & x_to_w) b = b ^ prim_poly;
   }
+  select_kernel();
   return 0; 
 }
+#else
+/*
+ * the tables are generated at build time, only the kernel is left to pick
+ */
+int setup_tables()
+{
+  select_kernel();
+  return 0;
+}
+#endif
+
+/** 
+ * encoding matrix generated at build time
+ * 
+ * @param type EC_MAT_VANDERMONDE or EC_MAT_CAUCHY
+ * @param n_rows number of coding fragments
+ * @param n_cols number of data fragments
+ * 
+ * @return the n_rows x n_cols elements, or NULL if the shape is not
+ *   generated
+ */
+const t_gf_elt *gf_gen_matrix(int type, u_int n_rows, u_int n_cols)
+{
+  int i;
+
+  for (i = 0;i < N_GEN_MATS;i++) {
+    if (gen_mats[i].type == type && gen_mats[i].n_rows == n_rows &&
+        gen_mats[i].n_cols == n_cols)
+      return gen_mats[i].mem;
+  }
+  return NULL;
+}
 
 void dump_tables()
 {
@@ -93,11 +148,15 @@ void dump_tables()
 
 int gmul(int a, int b)
 {
+#ifdef HAVE_GFMUL
+  return gfmul[a][b];
+#else
   int sum_log;
   if (a == 0 || b == 0) return 0;
   sum_log = gflog[a] + gflog[b];
   if (sum_log >= NW-1) sum_log -= NW-1;
   return gfilog[sum_log];
+#endif
 }
 
 int gdiv(int a, int b)
@@ -112,25 +171,1046 @@ int gdiv(int a, int b)
 
 int gpow(int a, int b)
 {
-  int r, i;
-
   if (0 == b)
     return 1;
+  if (0 == a)
+    return 0;
+  //a^b = ilog(b * log(a)), the logs being taken mod NW-1
+  return gfilog[(u_int) ((unsigned long long) gflog[a] * b % (NW-1))];
+}
+
+/*
+ * dst = coeff * src (or dst ^= coeff * src if xor) over len bytes of words,
+ * one word at a time
+ */
+static void region_mul_words(void *dst, const void *src, int coeff, size_t len,
+                             int xor)
+{
+  size_t i;
+#if W == 4 || W == 8
+  u_char *d = dst;
+  const u_char *s = src;
+  u_char x;
+
+  for (i = 0;i < len;i++) {
+# if W == 4
+    x = gmul(coeff, s[i] & 0xf) | (gmul(coeff, s[i] >> 4) << 4);
+# else
+    x = gmul(coeff, s[i]);
+# endif
+    if (xor)
+      d[i] ^= x;
+    else
+      d[i] = x;
+  }
+#elif W == 16
+  u_short *d = dst;
+  const u_short *s = src;
+  u_short x;
+
+  for (i = 0;i < len / 2;i++) {
+    x = gmul(coeff, s[i]);
+    if (xor)
+      d[i] ^= x;
+    else
+      d[i] = x;
+  }
+#endif
+}
+
+/*
+ * W=4/8: product of coeff by every byte value (one byte holds two symbols
+ * for W=4). W=16 works in the log domain and needs no table.
+ */
+static void prepare_scalar(t_gf_tables *t, int coeff)
+{
+#if W == 8 && defined(HAVE_GFMUL)
+  memcpy(t->tbl, gfmul[coeff], 256);
+#elif W == 4 || W == 8
+  int b;
+
+  for (b = 0;b < 256;b++) {
+# if W == 4
+    t->tbl[b] = gmul(coeff, b & 0xf) | (gmul(coeff, b >> 4) << 4);
+# else
+    t->tbl[b] = gmul(coeff, b);
+# endif
+  }
+#endif
+}
+
+/*
+ * dst = coeff * src (or dst ^= coeff * src if xor) over len bytes of words
+ */
+static void region_mul_scalar(void *dst, const void *src, const t_gf_tables *t,
+                              size_t len, int xor)
+{
+  size_t i;
+#if W == 4 || W == 8
+  u_char *d = dst;
+  const u_char *s = src;
+  const u_char *tbl = t->tbl;
+
+  if (xor) {
+    for (i = 0;i < len;i++)
+      d[i] ^= tbl[s[i]];
+  } else {
+    for (i = 0;i < len;i++)
+      d[i] = tbl[s[i]];
+  }
+#elif W == 16
+  u_short *d = dst;
+  const u_short *s = src;
+  int log_c = gflog[t->coeff];
+  int sum_log;
+  u_short x;
 
-  if (1 == b)
-    return a;
+  for (i = 0;i < len / 2;i++) {
+    x = s[i];
+    if (0 != x) {
+      sum_log = gflog[x] + log_c;
+      if (sum_log >= NW-1) sum_log -= NW-1;
+      x = gfilog[sum_log];
+    }
+    if (xor)
+      d[i] ^= x;
+    else
+      d[i] = x;
+  }
+#endif
+}
+
+#ifdef HAVE_X86_SIMD
+/*
+ * split tables: the product of coeff by a word is the xor of the products
+ * by each of its nibbles, so 16-entry tables indexed by nibbles can be
+ * looked up 16 or 32 at a time with pshufb.
+ */
+#if W == 4 || W == 8
+/* tbl[0]: products by the low nibble, tbl[1]: by the high nibble */
+static void prepare_split(t_gf_tables *t, int coeff)
+{
+  u_char (*tbl)[16] = (u_char (*)[16]) t->tbl;
+  int i;
+
+  for (i = 0;i < 16;i++) {
+# if W == 4
+    tbl[0][i] = gmul(coeff, i);
+    tbl[1][i] = gmul(coeff, i) << 4;
+# else
+    tbl[0][i] = gmul(coeff, i);
+    tbl[1][i] = gmul(coeff, i << 4);
+# endif
+  }
+}
+
+__attribute__((target("ssse3")))
+static void region_mul_ssse3(void *dst, const void *src, const t_gf_tables *t,
+                             size_t len, int xor)
+{
+  const u_char (*tbl)[16] = (const u_char (*)[16]) t->tbl;
+  __m128i t_lo, t_hi, mask, x, r;
+  size_t i;
+
+  t_lo = _mm_loadu_si128((__m128i *) tbl[0]);
+  t_hi = _mm_loadu_si128((__m128i *) tbl[1]);
+  mask = _mm_set1_epi8(0x0f);
+  for (i = 0;i + 16 <= len;i += 16) {
+    x = _mm_loadu_si128((__m128i *) ((u_char *) src + i));
+    r = _mm_xor_si128(_mm_shuffle_epi8(t_lo, _mm_and_si128(x, mask)),
+                      _mm_shuffle_epi8(t_hi, _mm_and_si128(_mm_srli_epi64(x, 4), mask)));
+    if (xor)
+      r = _mm_xor_si128(r, _mm_loadu_si128((__m128i *) ((u_char *) dst + i)));
+    _mm_storeu_si128((__m128i *) ((u_char *) dst + i), r);
+  }
+  if (i < len)
+    region_mul_words((u_char *) dst + i, (u_char *) src + i, t->coeff, len - i, xor);
+}
+
+__attribute__((target("avx2")))
+static void region_mul_avx2(void *dst, const void *src, const t_gf_tables *t,
+                            size_t len, int xor)
+{
+  const u_char (*tbl)[16] = (const u_char (*)[16]) t->tbl;
+  __m256i t_lo, t_hi, mask, x, r;
+  size_t i;
 
-  r = a;
-  for (i = 1; i < b;i++) {
-    r = gmul(r, a);
+  t_lo = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i *) tbl[0]));
+  t_hi = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i *) tbl[1]));
+  mask = _mm256_set1_epi8(0x0f);
+  for (i = 0;i + 32 <= len;i += 32) {
+    x = _mm256_loadu_si256((__m256i *) ((u_char *) src + i));
+    r = _mm256_xor_si256(_mm256_shuffle_epi8(t_lo, _mm256_and_si256(x, mask)),
+                         _mm256_shuffle_epi8(t_hi, _mm256_and_si256(_mm256_srli_epi64(x, 4), mask)));
+    if (xor)
+      r = _mm256_xor_si256(r, _mm256_loadu_si256((__m256i *) ((u_char *) dst + i)));
+    _mm256_storeu_si256((__m256i *) ((u_char *) dst + i), r);
   }
+  if (i < len)
+    region_mul_words((u_char *) dst + i, (u_char *) src + i, t->coeff, len - i, xor);
+}
+/*
+ * multi-output versions: the nibbles of MULTI_SUB bytes of source are
+ * extracted once, then looked up in the tables of every destination in
+ * turn
+ */
+__attribute__((target("ssse3")))
+static void region_mul_multi_ssse3(u_char **dst, const void *src,
+                                   const t_gf_tables *t, int n, size_t len,
+                                   int xor)
+{
+  __m128i lo[MULTI_SUB / 16], hi[MULTI_SUB / 16], t_lo, t_hi, mask, x, r;
+  size_t i, v, n_v;
+  int k;
+
+  mask = _mm_set1_epi8(0x0f);
+  for (i = 0;i + 16 <= len;i += n_v * 16) {
+    n_v = (len - i) / 16;
+    if (n_v > MULTI_SUB / 16)
+      n_v = MULTI_SUB / 16;
+    for (v = 0;v < n_v;v++) {
+      x = _mm_loadu_si128((__m128i *) ((u_char *) src + i + 16 * v));
+      lo[v] = _mm_and_si128(x, mask);
+      hi[v] = _mm_and_si128(_mm_srli_epi64(x, 4), mask);
+    }
+    for (k = 0;k < n;k++) {
+      __m128i *d = (__m128i *) (dst[k] + i);
+
+      t_lo = _mm_loadu_si128((__m128i *) t[k].tbl);
+      t_hi = _mm_loadu_si128((__m128i *) (t[k].tbl + 16));
+      if (xor) {
+        for (v = 0;v < n_v;v++) {
+          r = _mm_xor_si128(_mm_shuffle_epi8(t_lo, lo[v]),
+                            _mm_shuffle_epi8(t_hi, hi[v]));
+          _mm_storeu_si128(d + v, _mm_xor_si128(r, _mm_loadu_si128(d + v)));
+        }
+      } else {
+        for (v = 0;v < n_v;v++) {
+          r = _mm_xor_si128(_mm_shuffle_epi8(t_lo, lo[v]),
+                            _mm_shuffle_epi8(t_hi, hi[v]));
+          _mm_storeu_si128(d + v, r);
+        }
+      }
+    }
+  }
+  for (k = 0;i < len && k < n;k++)
+    region_mul_words(dst[k] + i, (u_char *) src + i, t[k].coeff, len - i, xor);
+}
+
+__attribute__((target("avx2")))
+static void region_mul_multi_avx2(u_char **dst, const void *src,
+                                  const t_gf_tables *t, int n, size_t len,
+                                  int xor)
+{
+  __m256i lo[MULTI_SUB / 32], hi[MULTI_SUB / 32], t_lo, t_hi, mask, x, r;
+  size_t i, v, n_v;
+  int k;
 
-  return r;
+  mask = _mm256_set1_epi8(0x0f);
+  for (i = 0;i + 32 <= len;i += n_v * 32) {
+    n_v = (len - i) / 32;
+    if (n_v > MULTI_SUB / 32)
+      n_v = MULTI_SUB / 32;
+    for (v = 0;v < n_v;v++) {
+      x = _mm256_loadu_si256((__m256i *) ((u_char *) src + i + 32 * v));
+      lo[v] = _mm256_and_si256(x, mask);
+      hi[v] = _mm256_and_si256(_mm256_srli_epi64(x, 4), mask);
+    }
+    for (k = 0;k < n;k++) {
+      __m256i *d = (__m256i *) (dst[k] + i);
+
+      t_lo = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i *) t[k].tbl));
+      t_hi = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i *) (t[k].tbl + 16)));
+      if (xor) {
+        for (v = 0;v < n_v;v++) {
+          r = _mm256_xor_si256(_mm256_shuffle_epi8(t_lo, lo[v]),
+                               _mm256_shuffle_epi8(t_hi, hi[v]));
+          _mm256_storeu_si256(d + v, _mm256_xor_si256(r, _mm256_loadu_si256(d + v)));
+        }
+      } else {
+        for (v = 0;v < n_v;v++) {
+          r = _mm256_xor_si256(_mm256_shuffle_epi8(t_lo, lo[v]),
+                               _mm256_shuffle_epi8(t_hi, hi[v]));
+          _mm256_storeu_si256(d + v, r);
+        }
+      }
+    }
+  }
+  for (k = 0;i < len && k < n;k++)
+    region_mul_words(dst[k] + i, (u_char *) src + i, t[k].coeff, len - i, xor);
+}
+#elif W == 16
+/*
+ * tbl[p][0] (resp. tbl[p][1]): low (resp. high) byte of the products by
+ * nibble p of the word. The words are split into a vector of low bytes and
+ * a vector of high bytes so that each nibble can be used as a pshufb index.
+ */
+static void prepare_split(t_gf_tables *t, int coeff)
+{
+  u_char (*tbl)[2][16] = (u_char (*)[2][16]) t->tbl;
+  int p, i, x;
+
+  for (p = 0;p < 4;p++) {
+    for (i = 0;i < 16;i++) {
+      x = gmul(coeff, i << (4 * p));
+      tbl[p][0][i] = x & 0xff;
+      tbl[p][1][i] = x >> 8;
+    }
+  }
+}
+
+__attribute__((target("ssse3")))
+static void region_mul_ssse3(void *dst, const void *src, const t_gf_tables *t,
+                             size_t len, int xor)
+{
+  const u_char (*tbl)[2][16] = (const u_char (*)[2][16]) t->tbl;
+  __m128i vt[4][2], mask, split, a, b, lo, hi, n[4], r_lo, r_hi, r0, r1;
+  size_t i;
+  int p, h;
+
+  for (p = 0;p < 4;p++)
+    for (h = 0;h < 2;h++)
+      vt[p][h] = _mm_loadu_si128((__m128i *) tbl[p][h]);
+  mask = _mm_set1_epi8(0x0f);
+  split = _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15);
+  for (i = 0;i + 32 <= len;i += 32) {
+    a = _mm_shuffle_epi8(_mm_loadu_si128((__m128i *) ((u_char *) src + i)), split);
+    b = _mm_shuffle_epi8(_mm_loadu_si128((__m128i *) ((u_char *) src + i + 16)), split);
+    lo = _mm_unpacklo_epi64(a, b);
+    hi = _mm_unpackhi_epi64(a, b);
+    n[0] = _mm_and_si128(lo, mask);
+    n[1] = _mm_and_si128(_mm_srli_epi64(lo, 4), mask);
+    n[2] = _mm_and_si128(hi, mask);
+    n[3] = _mm_and_si128(_mm_srli_epi64(hi, 4), mask);
+    r_lo = _mm_setzero_si128();
+    r_hi = _mm_setzero_si128();
+    for (p = 0;p < 4;p++) {
+      r_lo = _mm_xor_si128(r_lo, _mm_shuffle_epi8(vt[p][0], n[p]));
+      r_hi = _mm_xor_si128(r_hi, _mm_shuffle_epi8(vt[p][1], n[p]));
+    }
+    r0 = _mm_unpacklo_epi8(r_lo, r_hi);
+    r1 = _mm_unpackhi_epi8(r_lo, r_hi);
+    if (xor) {
+      r0 = _mm_xor_si128(r0, _mm_loadu_si128((__m128i *) ((u_char *) dst + i)));
+      r1 = _mm_xor_si128(r1, _mm_loadu_si128((__m128i *) ((u_char *) dst + i + 16)));
+    }
+    _mm_storeu_si128((__m128i *) ((u_char *) dst + i), r0);
+    _mm_storeu_si128((__m128i *) ((u_char *) dst + i + 16), r1);
+  }
+  if (i < len)
+    region_mul_words((u_char *) dst + i, (u_char *) src + i, t->coeff, len - i, xor);
+}
+
+/*
+ * same as the ssse3 version on 256-bit vectors: unpack operates within
+ * 128-bit lanes, which is harmless since the split and the merge do so too
+ */
+__attribute__((target("avx2")))
+static void region_mul_avx2(void *dst, const void *src, const t_gf_tables *t,
+                            size_t len, int xor)
+{
+  const u_char (*tbl)[2][16] = (const u_char (*)[2][16]) t->tbl;
+  __m256i vt[4][2], mask, split, a, b, lo, hi, n[4], r_lo, r_hi, r0, r1;
+  size_t i;
+  int p, h;
+
+  for (p = 0;p < 4;p++)
+    for (h = 0;h < 2;h++)
+      vt[p][h] = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i *) tbl[p][h]));
+  mask = _mm256_set1_epi8(0x0f);
+  split = _mm256_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15,
+                           0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15);
+  for (i = 0;i + 64 <= len;i += 64) {
+    a = _mm256_shuffle_epi8(_mm256_loadu_si256((__m256i *) ((u_char *) src + i)), split);
+    b = _mm256_shuffle_epi8(_mm256_loadu_si256((__m256i *) ((u_char *) src + i + 32)), split);
+    lo = _mm256_unpacklo_epi64(a, b);
+    hi = _mm256_unpackhi_epi64(a, b);
+    n[0] = _mm256_and_si256(lo, mask);
+    n[1] = _mm256_and_si256(_mm256_srli_epi64(lo, 4), mask);
+    n[2] = _mm256_and_si256(hi, mask);
+    n[3] = _mm256_and_si256(_mm256_srli_epi64(hi, 4), mask);
+    r_lo = _mm256_setzero_si256();
+    r_hi = _mm256_setzero_si256();
+    for (p = 0;p < 4;p++) {
+      r_lo = _mm256_xor_si256(r_lo, _mm256_shuffle_epi8(vt[p][0], n[p]));
+      r_hi = _mm256_xor_si256(r_hi, _mm256_shuffle_epi8(vt[p][1], n[p]));
+    }
+    r0 = _mm256_unpacklo_epi8(r_lo, r_hi);
+    r1 = _mm256_unpackhi_epi8(r_lo, r_hi);
+    if (xor) {
+      r0 = _mm256_xor_si256(r0, _mm256_loadu_si256((__m256i *) ((u_char *) dst + i)));
+      r1 = _mm256_xor_si256(r1, _mm256_loadu_si256((__m256i *) ((u_char *) dst + i + 32)));
+    }
+    _mm256_storeu_si256((__m256i *) ((u_char *) dst + i), r0);
+    _mm256_storeu_si256((__m256i *) ((u_char *) dst + i + 32), r1);
+  }
+  if (i < len)
+    region_mul_words((u_char *) dst + i, (u_char *) src + i, t->coeff, len - i, xor);
+}
+
+/*
+ * multi-output versions: the source words are split into nibbles once
+ * and looked up in the tables of every destination in turn
+ */
+__attribute__((target("ssse3")))
+static void region_mul_multi_ssse3(u_char **dst, const void *src,
+                                   const t_gf_tables *t, int n, size_t len,
+                                   int xor)
+{
+  __m128i vt[n][4][2], mask, split, a, b, lo, hi, nb[4], r_lo, r_hi, r0, r1;
+  size_t i;
+  int k, p, h;
+
+  for (k = 0;k < n;k++)
+    for (p = 0;p < 4;p++)
+      for (h = 0;h < 2;h++)
+        vt[k][p][h] = _mm_loadu_si128((__m128i *) (t[k].tbl + 32 * p + 16 * h));
+  mask = _mm_set1_epi8(0x0f);
+  split = _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15);
+  for (i = 0;i + 32 <= len;i += 32) {
+    a = _mm_shuffle_epi8(_mm_loadu_si128((__m128i *) ((u_char *) src + i)), split);
+    b = _mm_shuffle_epi8(_mm_loadu_si128((__m128i *) ((u_char *) src + i + 16)), split);
+    lo = _mm_unpacklo_epi64(a, b);
+    hi = _mm_unpackhi_epi64(a, b);
+    nb[0] = _mm_and_si128(lo, mask);
+    nb[1] = _mm_and_si128(_mm_srli_epi64(lo, 4), mask);
+    nb[2] = _mm_and_si128(hi, mask);
+    nb[3] = _mm_and_si128(_mm_srli_epi64(hi, 4), mask);
+    for (k = 0;k < n;k++) {
+      r_lo = _mm_setzero_si128();
+      r_hi = _mm_setzero_si128();
+      for (p = 0;p < 4;p++) {
+        r_lo = _mm_xor_si128(r_lo, _mm_shuffle_epi8(vt[k][p][0], nb[p]));
+        r_hi = _mm_xor_si128(r_hi, _mm_shuffle_epi8(vt[k][p][1], nb[p]));
+      }
+      r0 = _mm_unpacklo_epi8(r_lo, r_hi);
+      r1 = _mm_unpackhi_epi8(r_lo, r_hi);
+      if (xor) {
+        r0 = _mm_xor_si128(r0, _mm_loadu_si128((__m128i *) (dst[k] + i)));
+        r1 = _mm_xor_si128(r1, _mm_loadu_si128((__m128i *) (dst[k] + i + 16)));
+      }
+      _mm_storeu_si128((__m128i *) (dst[k] + i), r0);
+      _mm_storeu_si128((__m128i *) (dst[k] + i + 16), r1);
+    }
+  }
+  for (k = 0;i < len && k < n;k++)
+    region_mul_words(dst[k] + i, (u_char *) src + i, t[k].coeff, len - i, xor);
+}
+
+__attribute__((target("avx2")))
+static void region_mul_multi_avx2(u_char **dst, const void *src,
+                                  const t_gf_tables *t, int n, size_t len,
+                                  int xor)
+{
+  __m256i vt[n][4][2], mask, split, a, b, lo, hi, nb[4], r_lo, r_hi, r0, r1;
+  size_t i;
+  int k, p, h;
+
+  for (k = 0;k < n;k++)
+    for (p = 0;p < 4;p++)
+      for (h = 0;h < 2;h++)
+        vt[k][p][h] = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i *) (t[k].tbl + 32 * p + 16 * h)));
+  mask = _mm256_set1_epi8(0x0f);
+  split = _mm256_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15,
+                           0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15);
+  for (i = 0;i + 64 <= len;i += 64) {
+    a = _mm256_shuffle_epi8(_mm256_loadu_si256((__m256i *) ((u_char *) src + i)), split);
+    b = _mm256_shuffle_epi8(_mm256_loadu_si256((__m256i *) ((u_char *) src + i + 32)), split);
+    lo = _mm256_unpacklo_epi64(a, b);
+    hi = _mm256_unpackhi_epi64(a, b);
+    nb[0] = _mm256_and_si256(lo, mask);
+    nb[1] = _mm256_and_si256(_mm256_srli_epi64(lo, 4), mask);
+    nb[2] = _mm256_and_si256(hi, mask);
+    nb[3] = _mm256_and_si256(_mm256_srli_epi64(hi, 4), mask);
+    for (k = 0;k < n;k++) {
+      r_lo = _mm256_setzero_si256();
+      r_hi = _mm256_setzero_si256();
+      for (p = 0;p < 4;p++) {
+        r_lo = _mm256_xor_si256(r_lo, _mm256_shuffle_epi8(vt[k][p][0], nb[p]));
+        r_hi = _mm256_xor_si256(r_hi, _mm256_shuffle_epi8(vt[k][p][1], nb[p]));
+      }
+      r0 = _mm256_unpacklo_epi8(r_lo, r_hi);
+      r1 = _mm256_unpackhi_epi8(r_lo, r_hi);
+      if (xor) {
+        r0 = _mm256_xor_si256(r0, _mm256_loadu_si256((__m256i *) (dst[k] + i)));
+        r1 = _mm256_xor_si256(r1, _mm256_loadu_si256((__m256i *) (dst[k] + i + 32)));
+      }
+      _mm256_storeu_si256((__m256i *) (dst[k] + i), r0);
+      _mm256_storeu_si256((__m256i *) (dst[k] + i + 32), r1);
+    }
+  }
+  for (k = 0;i < len && k < n;k++)
+    region_mul_words(dst[k] + i, (u_char *) src + i, t[k].coeff, len - i, xor);
+}
+#endif
+
+static int have_ssse3()
+{
+  return __builtin_cpu_supports("ssse3");
+}
+
+static int have_avx2()
+{
+  return __builtin_cpu_supports("avx2");
+}
+#endif
+
+static int have_scalar()
+{
+  return 1;
+}
+
+typedef void (*t_region_fn)(void *dst, const void *src, const t_gf_tables *t,
+                            size_t len, int xor);
+typedef void (*t_multi_fn)(u_char **dst, const void *src,
+                           const t_gf_tables *t, int n, size_t len, int xor);
+
+/*
+ * multi-output fallback: one pass over the source per destination
+ */
+static void region_mul_multi_loop(u_char **dst, const void *src,
+                                  const t_gf_tables *t, int n, size_t len,
+                                  int xor)
+{
+  int k;
+
+  for (k = 0;k < n;k++) {
+    if (xor)
+      gf_region_mul_xor_tables(dst[k], src, &t[k], len);
+    else
+      gf_region_mul_tables(dst[k], src, &t[k], len);
+  }
+}
+
+/* region kernels, best first */
+static struct s_kernel
+{
+  char *name;
+  void (*prepare)(t_gf_tables *t, int coeff);
+  t_region_fn fn;
+  t_multi_fn multi;
+  int (*supported)();
+} kernels[] = {
+#ifdef HAVE_X86_SIMD
+  { "avx2", prepare_split, region_mul_avx2, region_mul_multi_avx2, have_avx2 },
+  { "ssse3", prepare_split, region_mul_ssse3, region_mul_multi_ssse3,
+    have_ssse3 },
+#endif
+  { "scalar", prepare_scalar, region_mul_scalar, region_mul_multi_loop,
+    have_scalar },
+};
+#define N_KERNELS (sizeof (kernels) / sizeof (kernels[0]))
+
+static struct s_kernel *kernel = &kernels[N_KERNELS - 1];
+
+/*
+ * pick the best region kernel supported by the CPU
+ */
+static void select_kernel()
+{
+  int i;
+
+  for (i = 0;i < N_KERNELS;i++) {
+    if (kernels[i].supported()) {
+      kernel = &kernels[i];
+      break ;
+    }
+  }
+}
+
+char *gf_kernel_name()
+{
+  return kernel->name;
+}
+
+/** 
+ * precompute the tables of the region kernel for one coefficient, so that
+ * they can be reused across calls and shared between threads
+ * 
+ * @param t tables to fill
+ * @param coeff field element
+ */
+void gf_tables_init(t_gf_tables *t, int coeff)
+{
+  t->coeff = coeff;
+  //the multi-output kernels go through the tables even for 0 and 1
+  kernel->prepare(t, coeff);
+}
+
+/** 
+ * multiply a region of words by a constant
+ * 
+ * @param dst destination region
+ * @param src source region (may be equal to dst)
+ * @param t tables of the constant
+ * @param len length in bytes, must be a multiple of the word size
+ */
+void gf_region_mul_tables(void *dst, const void *src, const t_gf_tables *t,
+                          size_t len)
+{
+  if (0 == t->coeff)
+    memset(dst, 0, len);
+  else if (1 == t->coeff) {
+    if (dst != src)
+      memcpy(dst, src, len);
+  } else
+    kernel->fn(dst, src, t, len, 0);
+}
+
+/** 
+ * multiply a region of words by a constant and accumulate it into dst
+ * 
+ * @param dst destination region
+ * @param src source region
+ * @param t tables of the constant
+ * @param len length in bytes, must be a multiple of the word size
+ */
+void gf_region_mul_xor_tables(void *dst, const void *src, const t_gf_tables *t,
+                              size_t len)
+{
+  //the tables of 1 make the kernel a plain vectorized xor
+  if (0 != t->coeff)
+    kernel->fn(dst, src, t, len, 1);
+}
+
+/** 
+ * multiply a region of words by n constants into n destinations, the
+ * source being read once
+ * 
+ * @param dst n destination regions, distinct from src
+ * @param src source region
+ * @param t n tables, one per destination
+ * @param n number of destinations
+ * @param len length in bytes, must be a multiple of the word size
+ * @param xor accumulate into the destinations instead of overwriting them
+ */
+void gf_region_mul_multi(u_char **dst, const void *src, const t_gf_tables *t,
+                         int n, size_t len, int xor)
+{
+  kernel->multi(dst, src, t, n, len, xor);
+}
+
+/** 
+ * multiply a region of words by a constant
+ * 
+ * @param dst destination region
+ * @param src source region (may be equal to dst)
+ * @param coeff field element
+ * @param len length in bytes, must be a multiple of the word size
+ */
+void gf_region_mul(void *dst, const void *src, int coeff, size_t len)
+{
+  t_gf_tables t;
+
+  gf_tables_init(&t, coeff);
+  gf_region_mul_tables(dst, src, &t, len);
+}
+
+/** 
+ * multiply a region of words by a constant and accumulate it into dst
+ * 
+ * @param dst destination region
+ * @param src source region
+ * @param coeff field element
+ * @param len length in bytes, must be a multiple of the word size
+ */
+void gf_region_mul_xor(void *dst, const void *src, int coeff, size_t len)
+{
+  t_gf_tables t;
+
+  gf_tables_init(&t, coeff);
+  gf_region_mul_xor_tables(dst, src, &t, len);
+}
+
+/* W=16 rows at least this long go through the region kernels */
+#define ROW_REGION_MIN 64
+
+/** 
+ * row operation of the matrix code: dst = coeff * src, or dst ^= coeff *
+ * src if xor, over n elements. W=16 elements are stored as words, so long
+ * rows are handed to the region kernels; other fields look the products
+ * up element by element.
+ * 
+ * @param dst destination row
+ * @param src source row (may be equal to dst)
+ * @param coeff field element
+ * @param n number of elements
+ * @param xor accumulate into dst instead of overwriting it
+ */
+void gf_row_mul(t_gf_elt *dst, const t_gf_elt *src, int coeff, u_int n,
+                int xor)
+{
+  u_int k;
+#ifdef HAVE_GFMUL
+  const u_char *m = gfmul[coeff];
+
+  for (k = 0;k < n;k++)
+    dst[k] = (xor ? dst[k] : 0) ^ m[src[k]];
+#else
+  int log_c, l;
+
+# if W == 16
+  if (n >= ROW_REGION_MIN) {
+    if (xor)
+      gf_region_mul_xor(dst, src, coeff, n * sizeof (t_gf_elt));
+    else
+      gf_region_mul(dst, src, coeff, n * sizeof (t_gf_elt));
+    return ;
+  }
+# endif
+  if (0 == coeff) {
+    if (!xor)
+      memset(dst, 0, n * sizeof (t_gf_elt));
+    return ;
+  }
+  log_c = gflog[coeff];
+  for (k = 0;k < n;k++) {
+    if (0 == src[k]) {
+      if (!xor)
+        dst[k] = 0;
+      continue ;
+    }
+    l = gflog[src[k]] + log_c;
+    if (l >= NW-1)
+      l -= NW-1;
+    dst[k] = (xor ? dst[k] : 0) ^ gfilog[l];
+  }
+#endif
+}
+
+/*
+ * CRC32C of a region spanning several interleaved lanes, at an odd
+ * offset, must match the CRC chained over small pieces
+ */
+static void utest_crc()
+{
+  u_char buf[100003];
+  u_int32_t crc = 0;
+  size_t i, n;
+
+  for (i = 0;i < sizeof (buf);i++)
+    buf[i] = random();
+  for (i = 1;i < sizeof (buf);i += n) {
+    n = (sizeof (buf) - i < 1000) ? sizeof (buf) - i : 1000;
+    crc = crc32c(crc, buf + i, n);
+  }
+  assert(crc == crc32c(0, buf + 1, sizeof (buf) - 1));
+}
+
+/*
+ * the generated multiplication and log tables must agree
+ */
+static void utest_tables()
+{
+  int a, b;
+
+  for (a = 0;a < NW;a++) {
+    for (b = 1;b < NW;b += (NW > 256) ? 251 : 1) {
+      assert(gdiv(gmul(a, b), b) == a);
+      assert(gmul(a, b) == gmul(b, a));
+    }
+  }
+}
+
+/*
+ * check every supported region kernel against gmul, including the
+ * unaligned tails handled by the scalar code
+ */
+static void utest_region()
+{
+  u_char src[512], dst[512], ref[512], m0[512], m1[512];
+  u_char *mdst[2] = { m0, m1 };
+  t_gf_tables t[2];
+  size_t len = sizeof (src) - 2;
+  struct s_kernel *best = kernel;
+  int coeff, i, k;
+#if W != 8
+  int x;
+#endif
+
+  for (i = 0;i < sizeof (src);i++)
+    src[i] = i * 7 + (i >> 3);
+  for (k = 0;k < N_KERNELS;k++) {
+    if (!kernels[k].supported())
+      continue ;
+    kernel = &kernels[k];
+    for (coeff = 0;coeff < NW;coeff += (NW > 256) ? 97 : 1) {
+      for (i = 0;i < sizeof (src);i++)
+        dst[i] = ref[i] = i;
+      gf_region_mul_xor(dst, src, coeff, len);
+#if W == 4
+      for (i = 0;i < len;i++) {
+        x = gmul(coeff, src[i] & 0xf) | (gmul(coeff, src[i] >> 4) << 4);
+        ref[i] ^= x;
+      }
+#elif W == 8
+      for (i = 0;i < len;i++)
+        ref[i] ^= gmul(coeff, src[i]);
+#elif W == 16
+      for (i = 0;i < len / 2;i++) {
+        x = gmul(coeff, ((u_short *) src)[i]);
+        ((u_short *) ref)[i] ^= x;
+      }
+#endif
+      assert(0 == memcmp(dst, ref, sizeof (src)));
+      //same through the multi-output kernel, next to the identity
+      for (i = 0;i < sizeof (src);i++)
+        m0[i] = m1[i] = i;
+      gf_tables_init(&t[0], coeff);
+      gf_tables_init(&t[1], 1);
+      gf_region_mul_multi(mdst, src, t, 2, len, 1);
+      assert(0 == memcmp(m0, ref, sizeof (src)));
+      for (i = 0;i < len;i++)
+        assert(m1[i] == (u_char) (i ^ src[i]));
+      gf_region_mul(dst, src, coeff, len);
+      gf_region_mul_xor(dst, src, coeff, len);
+      for (i = 0;i < len;i++)
+        assert(0 == dst[i]);
+    }
+  }
+  kernel = best;
+}
+
+#define UTEST_N_DATA    5
+#define UTEST_N_CODING  3
+#define UTEST_LEN       100004  /* several bit-matrix chunks plus a tail */
+
+struct s_utest_enc
+{
+  t_ec_ctx *ctx;
+  u_char **data;
+  u_char *coding[UTEST_N_CODING];
+};
+
+static void *utest_encoder(void *arg)
+{
+  struct s_utest_enc *e = arg;
+  int ret;
+
+  ret = ec_encode(e->ctx, e->data, e->coding, UTEST_LEN);
+  assert(EC_OK == ret);
+  return NULL;
+}
+
+/*
+ * degraded reads of every erased fragment, over one alignment unit in the
+ * middle of the fragments and up to their end
+ */
+static void utest_range(t_ec_ctx *ctx, u_char **frags, u_char **saved,
+                        int *erasures, int n_erasures)
+{
+  int n = UTEST_N_DATA + UTEST_N_CODING;
+  u_char *in[n];
+  u_char out[UTEST_LEN];
+  size_t align = ec_range_align(ctx);
+  size_t start = (UTEST_LEN / 3) / align * align;
+  size_t lens[2] = { align, UTEST_LEN - start };
+  int i, l, ret;
+
+  for (i = 0;i < n;i++)
+    in[i] = frags[i] + start;
+  for (l = 0;l < n_erasures;l++) {
+    for (i = 0;i < 2;i++) {
+      memset(out, 0, lens[i]);
+      ret = ec_decode_range(ctx, in, erasures, n_erasures, erasures[l], out,
+                            lens[i]);
+      assert(EC_OK == ret);
+      assert(0 == memcmp(out, saved[erasures[l]] + start, lens[i]));
+    }
+  }
+}
+
+/*
+ * round trip through the library API, from several threads sharing one
+ * context
+ */
+static void utest_libec()
+{
+  int patterns[][UTEST_N_CODING + 1] = {
+    /* number of erasures, then their indexes */
+    { 1, 0 },
+    { 1, 6 },
+    { 2, 1, 3 },
+    { 3, 0, 2, 4 },
+    { 3, 5, 6, 7 },
+    { 3, 1, 4, 6 },
+  };
+  int n = UTEST_N_DATA + UTEST_N_CODING;
+  u_char *frags[n], *saved[n];
+  struct s_utest_enc enc[4];
+  pthread_t threads[4];
+  t_ec_ctx *ctx;
+  int type, i, p, t, ret;
+  int too_many[UTEST_N_CODING + 1] = { 0, 1, 2, 3 };
+
+  for (i = 0;i < n;i++) {
+    frags[i] = xmalloc(UTEST_LEN);
+    saved[i] = xmalloc(UTEST_LEN);
+  }
+  for (type = EC_MAT_VANDERMONDE;type <= EC_MAT_CAUCHY_XOR;type++) {
+    ret = ec_ctx_create(&ctx, UTEST_N_DATA, UTEST_N_CODING, type);
+    assert(EC_OK == ret);
+    for (i = 0;i < UTEST_N_DATA;i++)
+      for (p = 0;p < UTEST_LEN;p++)
+        frags[i][p] = rand();
+    ret = ec_encode(ctx, frags, frags + UTEST_N_DATA, UTEST_LEN);
+    assert(EC_OK == ret);
+    for (i = 0;i < n;i++)
+      memcpy(saved[i], frags[i], UTEST_LEN);
+
+    for (t = 0;t < 4;t++) {
+      enc[t].ctx = ctx;
+      enc[t].data = frags;
+      for (i = 0;i < UTEST_N_CODING;i++)
+        enc[t].coding[i] = xmalloc(UTEST_LEN);
+      pthread_create(&threads[t], NULL, utest_encoder, &enc[t]);
+    }
+    for (t = 0;t < 4;t++) {
+      pthread_join(threads[t], NULL);
+      for (i = 0;i < UTEST_N_CODING;i++) {
+        assert(0 == memcmp(enc[t].coding[i], saved[UTEST_N_DATA + i], UTEST_LEN));
+        free(enc[t].coding[i]);
+      }
+    }
+
+    for (p = 0;p < sizeof (patterns) / sizeof (patterns[0]);p++) {
+      for (i = 1;i <= patterns[p][0];i++)
+        memset(frags[patterns[p][i]], 0, UTEST_LEN);
+      utest_range(ctx, frags, saved, patterns[p] + 1, patterns[p][0]);
+      ret = ec_decode(ctx, frags, patterns[p] + 1, patterns[p][0], UTEST_LEN);
+      assert(EC_OK == ret);
+      for (i = 0;i < n;i++)
+        assert(0 == memcmp(frags[i], saved[i], UTEST_LEN));
+    }
+    ret = ec_decode(ctx, frags, too_many, UTEST_N_CODING + 1, UTEST_LEN);
+    assert(EC_ETOOMANY == ret);
+    ret = ec_decode(ctx, frags, patterns[1] + 1, 1, UTEST_LEN - 1);
+    assert((1 == alignw(1)) || EC_EINVAL == ret);
+    ec_ctx_destroy(ctx);
+  }
+  for (i = 0;i < n;i++) {
+    free(frags[i]);
+    free(saved[i]);
+  }
+}
+
+/*
+ * the a_prime inverse taking the identity rows into account must match
+ * the general one, and powers must match repeated products
+ */
+static void utest_inv()
+{
+  int rows[6] = { 0, 6, 2, 8, 4, 9 };
+  t_mat *mat, *a1, *a2;
+  int a, b, r;
+
+  for (a = 0;a < 16;a++) {
+    r = 1;
+    for (b = 0;b < 40;b++) {
+      assert(gpow(a, b) == r);
+      r = gmul(r, a);
+    }
+  }
+
+  mat = mat_cauchy(4, 6);
+  assert(NULL != mat);
+  a1 = mat_a_prime(mat, rows);
+  a2 = mat_a_prime(mat, rows);
+  assert(NULL != a1 && NULL != a2);
+  assert(0 == mat_inv(a1));
+  assert(0 == mat_inv_a_prime(a2, rows));
+  assert(0 == memcmp(a1->mem, a2->mem, sizeof (t_gf_elt) * 36));
+  //data 2 used twice
+  rows[3] = 2;
+  assert(-1 == mat_inv_a_prime(a2, rows));
+  mat_free(a1);
+  mat_free(a2);
+  mat_free(mat);
+}
+
+/*
+ * the Cauchy matrix has its rows and columns scaled so that its first row
+ * and column are ones: c[i][j] / (c[0][j] c[i][0] / c[0][0]). The -s coding
+ * files depend on it. It is MDS: any n_cols of the data and coding
+ * fragments decode.
+ */
+static void utest_cauchy()
+{
+  int k = 5, m = 3;
+  int rows[5];
+  t_mat *mat, *a_prime;
+  int set, f, n, i, j, c;
+
+  mat = mat_cauchy(m, k);
+  assert(NULL != mat);
+  for (i = 0;i < m;i++) {
+    for (j = 0;j < k;j++) {
+      c = gdiv(gmul(gdiv(1, i ^ (j + m)), gdiv(1, m)),
+               gmul(gdiv(1, j + m), gdiv(1, i ^ m)));
+      assert(c == MAT_ITEM(mat, i, j));
+    }
+  }
+  for (set = 0;set < (1 << (k + m));set++) {
+    for (f = n = 0;f < k + m;f++) {
+      if ((set & (1 << f)) && n < k)
+        rows[n++] = f;
+    }
+    if (n < k || __builtin_popcount(set) != k)
+      continue ;
+    a_prime = mat_a_prime(mat, rows);
+    assert(NULL != a_prime);
+    assert(0 == mat_inv(a_prime));
+    mat_free(a_prime);
+  }
+  mat_free(mat);
+}
+
+/*
+ * local parities XOR their group, and a local parity is dependent on the
+ * data of its group and not on the others
+ */
+static void utest_lrc()
+{
+  t_mat *mat, *lrc, *basis;
+  int pivots[4];
+  int i, j, k;
+
+  mat = mat_vandermonde_correct(2, 4);
+  assert(NULL != mat);
+  lrc = mat_lrc(mat, 2);
+  assert(NULL != lrc && 4 == lrc->n_rows && 4 == lrc->n_cols);
+  for (j = 0;j < 4;j++) {
+    for (i = 0;i < 2;i++)
+      assert(MAT_ITEM(lrc, i, j) == MAT_ITEM(mat, i, j));
+    assert(MAT_ITEM(lrc, 2, j) == (j < 2));
+    assert(MAT_ITEM(lrc, 3, j) == (j >= 2));
+  }
+
+  basis = mat_calloc(4, 4);
+  assert(NULL != basis);
+  k = 0;
+  for (j = 0;j < 2;j++) {
+    t_gf_elt unit[4] = { 0, 0, 0, 0 };
+
+    unit[j] = 1;
+    k += mat_add_independent(basis, pivots, k, unit);
+  }
+  assert(2 == k);
+  assert(0 == mat_add_independent(basis, pivots, k, &MAT_ITEM(lrc, 2, 0)));
+  k += mat_add_independent(basis, pivots, k, &MAT_ITEM(lrc, 3, 0));
+  k += mat_add_independent(basis, pivots, k, &MAT_ITEM(lrc, 0, 0));
+  assert(4 == k);
+
+  mat_free(basis);
+  mat_free(lrc);
+  mat_free(mat);
 }
 
 void utest()
 {
 #if W == 4
+  int ret;
+
   assert(gmul(3, 7) == 9);
   assert(gmul(13, 10) == 11);  
   assert(gdiv(13, 10) == 3);
@@ -165,7 +1245,8 @@ void utest()
   VEC_ITEM(vec, 0) = 3;
   VEC_ITEM(vec, 1) = 11;
   VEC_ITEM(vec, 2) = 9;
-  mat_inv(mat);
+  ret = mat_inv(mat);
+  assert(0 == ret);
   mat_mult(output, mat, vec);
   assert(VEC_ITEM(output, 1) == 1);
   assert(VEC_ITEM(output, 2) == 9);
@@ -184,5 +1265,14 @@ void utest()
 #else
   //TBD
 #endif
+  assert(0xe3069283 == crc32c(0, "123456789", 9));
+  assert(0xe3069283 == crc32c(crc32c(0, "1234", 4), "56789", 5));
+  utest_crc();
+  utest_tables();
+  utest_region();
+  utest_cauchy();
+  utest_libec();
+  utest_lrc();
+  utest_inv();
 }
 
@@ -1,11 +1,34 @@
+/* field element, 16 bits for every W as only gf.c is built per field */
+typedef u_int16_t t_gf_elt;
 
-extern size_t sizew(size_t size);
-extern size_t freadw(void *ptr, FILE *stream);
-extern size_t fwritew(const void *ptr, FILE *stream);
+/* tables of one coefficient precomputed for the region kernels */
+typedef struct s_gf_tables
+{
+  int coeff;
+  u_char tbl[256] __attribute__ ((aligned (32)));
+} t_gf_tables;
+
+
+extern size_t alignw(size_t size);
+extern int get_w();
 extern int check_w();
 extern int setup_tables();
+extern const t_gf_elt *gf_gen_matrix(int type, u_int n_rows, u_int n_cols);
 extern void dump_tables();
 extern int gmul(int a, int b);
 extern int gdiv(int a, int b);
 extern int gpow(int a, int b);
+extern char *gf_kernel_name();
+extern void gf_tables_init(t_gf_tables *t, int coeff);
+extern void gf_region_mul_tables(void *dst, const void *src,
+                                 const t_gf_tables *t, size_t len);
+extern void gf_region_mul_xor_tables(void *dst, const void *src,
+                                     const t_gf_tables *t, size_t len);
+extern void gf_region_mul_multi(u_char **dst, const void *src,
+                                const t_gf_tables *t, int n, size_t len,
+                                int xor);
+extern void gf_region_mul(void *dst, const void *src, int coeff, size_t len);
+extern void gf_region_mul_xor(void *dst, const void *src, int coeff, size_t len);
+extern void gf_row_mul(t_gf_elt *dst, const t_gf_elt *src, int coeff, u_int n,
+                       int xor);
 extern void utest();
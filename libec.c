@@ -0,0 +1,291 @@
+/**
+ * @file   libec.c
+ * 
+ * @brief  In-memory codec: encode and decode caller-owned buffers
+ *         through a context, without touching files nor exiting on errors.
+ */
+
+#include "ec.h"
+
+struct s_ec_ctx
+{
+  u_int n_data;
+  u_int n_coding;
+  t_mat *mat;               /* n_coding x n_data encoding matrix */
+  t_gf_tables *tables;      /* kernel tables of mat, column by column */
+  t_bitmat *bm;             /* XOR schedule of mat, EC_MAT_CAUCHY_XOR only */
+};
+
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+static int tables_ret;
+
+static void init_tables()
+{
+  tables_ret = setup_tables();
+}
+
+/** 
+ * create a codec context
+ * 
+ * @param ctxp filled with the new context
+ * @param n_data number of data fragments
+ * @param n_coding number of coding fragments
+ * @param mat_type EC_MAT_VANDERMONDE, EC_MAT_CAUCHY or EC_MAT_CAUCHY_XOR
+ * 
+ * @return EC_OK or an error code
+ */
+int ec_ctx_create(t_ec_ctx **ctxp, u_int n_data, u_int n_coding, int mat_type)
+{
+  t_ec_ctx *ctx;
+  u_int i, j;
+
+  if (0 == n_data || 0 == n_coding || 0 != check_w(n_data + n_coding))
+    return EC_EINVAL;
+  if (EC_MAT_VANDERMONDE != mat_type && EC_MAT_CAUCHY != mat_type &&
+      EC_MAT_CAUCHY_XOR != mat_type)
+    return EC_EINVAL;
+
+  pthread_once(&tables_once, init_tables);
+  if (0 != tables_ret)
+    return EC_ENOMEM;
+
+  if (NULL == (ctx = calloc(1, sizeof (*ctx))))
+    return EC_ENOMEM;
+  ctx->n_data = n_data;
+  ctx->n_coding = n_coding;
+  if (EC_MAT_VANDERMONDE == mat_type)
+    ctx->mat = mat_vandermonde_correct(n_coding, n_data);
+  else
+    ctx->mat = mat_cauchy(n_coding, n_data);
+  ctx->tables = malloc(sizeof (t_gf_tables) * n_coding * n_data);
+  if (NULL == ctx->mat || NULL == ctx->tables) {
+    ec_ctx_destroy(ctx);
+    return EC_ENOMEM;
+  }
+  if (EC_MAT_CAUCHY_XOR == mat_type) {
+    bitmat_improve(ctx->mat);
+    if (NULL == (ctx->bm = bitmat_create(ctx->mat))) {
+      ec_ctx_destroy(ctx);
+      return EC_ENOMEM;
+    }
+  }
+  for (j = 0;j < n_data;j++)
+    for (i = 0;i < n_coding;i++)
+      gf_tables_init(&ctx->tables[j * n_coding + i], MAT_ITEM(ctx->mat, i, j));
+
+  *ctxp = ctx;
+  return EC_OK;
+}
+
+void ec_ctx_destroy(t_ec_ctx *ctx)
+{
+  if (ctx) {
+    bitmat_free(ctx->bm);
+    mat_free(ctx->mat);
+    free(ctx->tables);
+    free(ctx);
+  }
+}
+
+/** 
+ * compute the coding fragments
+ * 
+ * @param ctx context
+ * @param data n_data input regions
+ * @param coding n_coding output regions, none of which may be NULL
+ * @param len length of every region in bytes
+ * 
+ * @return EC_OK or an error code
+ */
+int ec_encode(t_ec_ctx *ctx, u_char **data, u_char **coding, size_t len)
+{
+  u_int i;
+
+  if (alignw(len) != len)
+    return EC_EINVAL;
+  for (i = 0;i < ctx->n_coding;i++) {
+    if (NULL == coding[i])
+      return EC_EINVAL;
+  }
+  if (NULL != ctx->bm) {
+    bitmat_mult_region(ctx->bm, data, coding, len, NULL);
+    return EC_OK;
+  }
+  mat_mult_region_tables(ctx->n_coding, ctx->n_data, ctx->tables, data,
+                         coding, len);
+  return EC_OK;
+}
+
+/*
+ * compute the lost fragments into out from the first n_data fragments
+ * not erased, through the rows of the repair matrix of the lost only
+ */
+static int decode_lost(t_ec_ctx *ctx, u_char **frags, u_char *erased,
+                       int *lost, int n_lost, u_char **out, size_t len)
+{
+  u_int n = ctx->n_data + ctx->n_coding;
+  int rows[ctx->n_data];
+  u_char *in[ctx->n_data];
+  t_mat *a_prime = NULL;
+  t_mat *rep = NULL;
+  t_bitmat *bm = NULL;
+  u_int i, k;
+  int ret;
+
+  //decode from the first n_data fragments available
+  k = 0;
+  for (i = 0;i < n && k < ctx->n_data;i++) {
+    if (!erased[i]) {
+      rows[k] = i;
+      in[k++] = frags[i];
+    }
+  }
+
+  if (NULL == (a_prime = mat_a_prime(ctx->mat, rows))) {
+    ret = EC_ENOMEM;
+    goto end;
+  }
+  switch (mat_inv_a_prime(a_prime, rows)) {
+  case 0:
+    break ;
+  case -1:
+    ret = EC_ESINGULAR;
+    goto end;
+  default:
+    ret = EC_ENOMEM;
+    goto end;
+  }
+  if (NULL == (rep = mat_repair(ctx->mat, a_prime, lost, n_lost))) {
+    ret = EC_ENOMEM;
+    goto end;
+  }
+  if (NULL == ctx->bm) {
+    mat_mult_region(rep, in, out, len);
+  } else {
+    if (NULL == (bm = bitmat_create(rep))) {
+      ret = EC_ENOMEM;
+      goto end;
+    }
+    bitmat_mult_region(bm, in, out, len, NULL);
+  }
+  ret = EC_OK;
+ end:
+  bitmat_free(bm);
+  mat_free(a_prime);
+  mat_free(rep);
+  return ret;
+}
+
+/*
+ * check the erasures and flag them in erased
+ */
+static int check_erasures(t_ec_ctx *ctx, int *erasures, int n_erasures,
+                          u_char *erased)
+{
+  u_int n = ctx->n_data + ctx->n_coding;
+  int l;
+
+  if (n_erasures < 0)
+    return EC_EINVAL;
+  memset(erased, 0, n);
+  for (l = 0;l < n_erasures;l++) {
+    if (erasures[l] < 0 || erasures[l] >= n || erased[erasures[l]])
+      return EC_EINVAL;
+    erased[erasures[l]] = 1;
+  }
+  if (n_erasures > ctx->n_coding)
+    return EC_ETOOMANY;
+  return EC_OK;
+}
+
+/** 
+ * rebuild erased fragments in place
+ * 
+ * @param ctx context
+ * @param frags n_data data regions followed by n_coding coding regions,
+ *   the erased ones being overwritten with their contents
+ * @param erasures indexes in frags of the erased fragments
+ * @param n_erasures number of erased fragments
+ * @param len length of every region in bytes
+ * 
+ * @return EC_OK or an error code
+ */
+int ec_decode(t_ec_ctx *ctx, u_char **frags, int *erasures, int n_erasures,
+              size_t len)
+{
+  u_char erased[ctx->n_data + ctx->n_coding];
+  u_char *out[ctx->n_coding];
+  int l, ret;
+
+  if (alignw(len) != len)
+    return EC_EINVAL;
+  if (0 == n_erasures)
+    return EC_OK;
+  if (EC_OK != (ret = check_erasures(ctx, erasures, n_erasures, erased)))
+    return ret;
+  for (l = 0;l < n_erasures;l++)
+    out[l] = frags[erasures[l]];
+  return decode_lost(ctx, frags, erased, erasures, n_erasures, out, len);
+}
+
+/** 
+ * granularity of the ranges given to ec_decode_range: the word size, or
+ * the bit-matrix chunk for EC_MAT_CAUCHY_XOR
+ * 
+ * @param ctx context
+ * 
+ * @return the alignment in bytes
+ */
+size_t ec_range_align(t_ec_ctx *ctx)
+{
+  if (NULL != ctx->bm)
+    return ctx->bm->w * EC_PACKET_SIZE;
+  return (get_w() + 7) / 8;
+}
+
+/** 
+ * degraded read: compute a range of a single fragment from the same
+ * range of n_data others, without rebuilding the rest of the erasures
+ * 
+ * @param ctx context
+ * @param frags n_data + n_coding regions holding the range of every
+ *   fragment, the erased ones being left alone
+ * @param erasures indexes in frags of the erased fragments
+ * @param n_erasures number of erased fragments
+ * @param index fragment whose range is wanted
+ * @param out filled with the range of fragment index
+ * @param len length of the range in bytes. The range must start on a
+ *   multiple of ec_range_align(), and end on one or at the end of the
+ *   fragments.
+ * 
+ * @return EC_OK or an error code
+ */
+int ec_decode_range(t_ec_ctx *ctx, u_char **frags, int *erasures,
+                    int n_erasures, int index, u_char *out, size_t len)
+{
+  u_char erased[ctx->n_data + ctx->n_coding];
+  int ret;
+
+  if (alignw(len) != len || index < 0 ||
+      index >= ctx->n_data + ctx->n_coding)
+    return EC_EINVAL;
+  if (EC_OK != (ret = check_erasures(ctx, erasures, n_erasures, erased)))
+    return ret;
+  if (!erased[index]) {
+    memcpy(out, frags[index], len);
+    return EC_OK;
+  }
+  return decode_lost(ctx, frags, erased, &index, 1, &out, len);
+}
+
+char *ec_strerror(int err)
+{
+  switch (err) {
+  case EC_OK: return "success";
+  case EC_EINVAL: return "invalid argument";
+  case EC_ENOMEM: return "out of memory";
+  case EC_ETOOMANY: return "too many erasures";
+  case EC_ESINGULAR: return "singular decoding matrix";
+  }
+  return "unknown error";
+}
@@ -0,0 +1,44 @@
+/**
+ * @file   libec.h
+ * 
+ * @brief  In-memory codec API
+ *         A context holds the field, the encoding matrix and the
+ *         precomputed kernel tables. It is read-only once created so any
+ *         number of threads can encode and decode through it concurrently.
+ *         Region lengths must be a multiple of the word size (2 bytes for
+ *         GF(2^16)). Errors are reported as negative EC_E* codes.
+ *         EC_MAT_CAUCHY_XOR fragments use the bit-sliced layout of
+ *         bitmat.c and are not interchangeable with EC_MAT_CAUCHY ones.
+ */
+
+#ifndef __LIBEC_H__
+#define __LIBEC_H__
+
+#include <sys/types.h>
+
+#define EC_MAT_VANDERMONDE 0
+#define EC_MAT_CAUCHY      1
+#define EC_MAT_CAUCHY_XOR  2    /* Cauchy bit-matrix, coded with XORs only */
+
+#define EC_OK           0
+#define EC_EINVAL       -1      /* bad argument */
+#define EC_ENOMEM       -2      /* out of memory */
+#define EC_ETOOMANY     -3      /* more erasures than coding fragments */
+#define EC_ESINGULAR    -4      /* decoding matrix cannot be inverted */
+
+typedef struct s_ec_ctx t_ec_ctx;
+
+extern int ec_ctx_create(t_ec_ctx **ctxp, u_int n_data, u_int n_coding,
+                         int mat_type);
+extern void ec_ctx_destroy(t_ec_ctx *ctx);
+extern int ec_encode(t_ec_ctx *ctx, u_char **data, u_char **coding,
+                     size_t len);
+extern int ec_decode(t_ec_ctx *ctx, u_char **frags, int *erasures,
+                     int n_erasures, size_t len);
+extern size_t ec_range_align(t_ec_ctx *ctx);
+extern int ec_decode_range(t_ec_ctx *ctx, u_char **frags, int *erasures,
+                           int n_erasures, int index, u_char *out,
+                           size_t len);
+extern char *ec_strerror(int err);
+
+#endif
@@ -2,27 +2,53 @@
 #include "ec.h"
 
 int vflag = 0;
+int n_threads = 1;
+int mflag = 0;
+int xflag = 0;
+int dflag = 0;
+int pflag = 0;
 
 void xusage()
 {
   fprintf(stderr,
-          "Usage: erasure [-n n_data][-m n_coding][-s (use cauchy instead of vandermonde)][-p prefix][-v (verbose)] -c (encode) | -r (repair) | -u (utest)\n");
+          "Usage: erasure [-n n_data][-m n_coding][-L n_local_groups][-s (use cauchy instead of vandermonde)][-p prefix][-j n_threads][-M (mmap i/o)][-D (O_DIRECT i/o)][-C decode_matrix_cache][-X (XOR bit-matrix coding)][-P (pipelined repair)][-v (verbose)]\n"
+          "       -c (encode) | -r (repair) | -V (verify) | -u (utest) |\n"
+          "       -U index -o offset -f new_contents [-O old_contents] (update) |\n"
+          "       -R index -o offset -l length (degraded read to stdout) |\n"
+          "       -B manifest|- -c|-r|-V (batch of the prefixes listed, on n_threads processes) |\n"
+          "       -Z socket (daemon serving -c/-r/-V on n_threads processes) | -z socket -p prefix -c|-r|-V (request to the daemon) |\n"
+          "       -S input|- [-b cell_size] (split and encode) | -J [-b cell_size] (decode to stdout)\n");
   exit(1);
 }
 
 int main(int argc, char **argv)
 {
   int n_data, n_coding, opt;
+  int n_local = 0;
   t_mat *mat;
   char *prefix = NULL;
+  char *cache_path = NULL;
+  char *new_path = NULL;
+  char *old_path = NULL;
+  int update_index = -1;
+  int range_index = -1;
+  off_t offset = -1;
+  size_t length = -1;
+  char *split_path = NULL;
+  char *manifest = NULL;
+  char *serve_path = NULL;
+  char *submit_path = NULL;
+  size_t cell = EC_CELL_SIZE;
+  int jflag = 0;
   int cflag = 0;
   int rflag = 0;
   int uflag = 0;
+  int Vflag = 0;
   int sflag = 0;
 
   n_data = n_coding = -1;
   prefix = NULL;
-  while ((opt = getopt(argc, argv, "n:m:p:scruv")) != -1) {
+  while ((opt = getopt(argc, argv, "n:m:L:p:j:C:U:R:o:l:f:O:S:B:Z:z:b:scruvMJXDVP")) != -1) {
     switch (opt) {
     case 'v':
       vflag = 1;
@@ -33,43 +59,137 @@ int main(int argc, char **argv)
     case 'c':
       cflag = 1;
       break ;
+    case 'V':
+      Vflag = 1;
+      break ;
     case 'r':
       rflag = 1;
       break ;
     case 's':
       sflag = 1;
       break ;
+    case 'M':
+      mflag = 1;
+      break ;
+    case 'X':
+      xflag = 1;
+      break ;
+    case 'D':
+      dflag = 1;
+      break ;
+    case 'P':
+      pflag = 1;
+      break ;
     case 'n':
       n_data = atoi(optarg);
       break;
     case 'm':
       n_coding = atoi(optarg);
       break;
+    case 'L':
+      n_local = atoi(optarg);
+      break;
     case 'p':
       prefix = xstrdup(optarg);
       break;
+    case 'U':
+      update_index = atoi(optarg);
+      break;
+    case 'R':
+      range_index = atoi(optarg);
+      break;
+    case 'o':
+      offset = atoll(optarg);
+      break;
+    case 'l':
+      length = atoll(optarg);
+      break;
+    case 'f':
+      new_path = optarg;
+      break;
+    case 'O':
+      old_path = optarg;
+      break;
+    case 'S':
+      split_path = optarg;
+      break;
+    case 'B':
+      manifest = optarg;
+      break;
+    case 'Z':
+      serve_path = optarg;
+      break;
+    case 'z':
+      submit_path = optarg;
+      break;
+    case 'J':
+      jflag = 1;
+      break;
+    case 'b':
+      cell = atol(optarg);
+      break;
+    case 'C':
+      cache_path = optarg;
+      break;
+    case 'j':
+      n_threads = atoi(optarg);
+      if (n_threads < 1)
+        xusage();
+      break;
     default: /* '?' */
       xusage();
     }
   }
 
-  if (!(uflag || cflag || rflag))
+  if (!(uflag || cflag || rflag || Vflag || jflag || -1 != update_index ||
+        -1 != range_index || NULL != split_path || NULL != serve_path))
     xusage();
 
-  if (0 != check_w(n_data + n_coding)) {
+  //a client only hands its request over, the daemon has the tables
+  if (NULL != submit_path) {
+    if (NULL == prefix || !(cflag || rflag || Vflag))
+      xusage();
+    if (0 != daemon_submit(submit_path, rflag ? EC_BATCH_REPAIR :
+                           Vflag ? EC_BATCH_VERIFY : EC_BATCH_ENCODE, prefix))
+      exit(1);
+    goto end;
+  }
+
+  if (0 != check_w(n_data + n_coding + n_local)) {
     fprintf(stderr, "Number of fragments is too big compared to Galois field size\n");
     exit(1);
   }
 
-  setup_tables();
+  if (0 != setup_tables())
+    xperror("setup_tables");
   //dump_tables();
+  if (vflag)
+    fprintf(stderr, "region kernel: %s\n", gf_kernel_name());
 
   if (uflag) {
     utest();
     goto end;
   }
 
-  if (-1 == n_data || -1 == n_coding || NULL == prefix)
+  if (-1 == n_data || -1 == n_coding ||
+      (NULL == prefix && NULL == manifest && NULL == serve_path))
+    xusage();
+  if (n_local < 0 || n_local > n_data)
+    xusage();
+  //a batch or a daemon encodes, repairs or verifies whole objects
+  if ((NULL != manifest || NULL != serve_path) &&
+      (jflag || -1 != update_index || -1 != range_index ||
+       NULL != split_path))
+    xusage();
+  if (NULL != manifest && NULL != serve_path)
+    xusage();
+
+  //only whole files are laid out in bit-sliced chunks
+  if (xflag && (pflag || jflag || -1 != update_index || NULL != split_path))
+    xusage();
+  //direct i/o is for the block engine
+  if (dflag && (jflag || -1 != update_index || -1 != range_index ||
+                NULL != split_path))
     xusage();
 
   if (sflag) {
@@ -77,15 +197,63 @@ int main(int argc, char **argv)
   } else {
     mat = mat_vandermonde_correct(n_coding, n_data);
   }
+  if (NULL == mat)
+    xperror("malloc");
+  if (xflag)
+    bitmat_improve(mat);
+  //local parities stay plain XORs, after the improvement
+  if (n_local > 0) {
+    t_mat *lrc;
+
+    if (NULL == (lrc = mat_lrc(mat, n_local)))
+      xperror("malloc");
+    mat_free(mat);
+    mat = lrc;
+  }
   if (vflag)
     mat_dump(mat);
 
-  if (rflag) {
+  if (NULL != serve_path) {
+    dcache_init(cache_path);
+    if (0 != daemon_serve(mat, serve_path)) {
+      exit(1);
+    }
+  } else if (NULL != manifest) {
+    dcache_init(cache_path);
+    if (0 != batch(rflag ? EC_BATCH_REPAIR :
+                   Vflag ? EC_BATCH_VERIFY : EC_BATCH_ENCODE, mat, manifest)) {
+      exit(1);
+    }
+  } else if (NULL != split_path) {
+    encode_stream(prefix, mat, split_path, cell);
+  } else if (jflag) {
+    dcache_init(cache_path);
+    if (0 != decode_stream(prefix, mat, cell)) {
+      exit(1);
+    }
+  } else if (-1 != update_index) {
+    if (-1 == offset || NULL == new_path)
+      xusage();
+    update_coding_files(prefix, mat, update_index, offset, new_path, old_path);
+  } else if (-1 != range_index) {
+    if (-1 == offset || -1 == length)
+      xusage();
+    dcache_init(cache_path);
+    if (0 != read_range(prefix, mat, range_index, offset, length)) {
+      exit(1);
+    }
+  } else if (Vflag) {
+    if (0 != verify_coding_files(prefix, mat)) {
+      exit(1);
+    }
+  } else if (rflag) {
+    dcache_init(cache_path);
     if (0 != repair_data_files(prefix, mat)) {
       exit(1);
     }
+  } else {
+    create_coding_files(prefix, mat);
   }
-  create_coding_files(prefix, mat);
 
   mat_free(mat);
 
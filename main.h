@@ -1 +1,6 @@
 extern int vflag;
+extern int n_threads;
+extern int mflag;
+extern int xflag;
+extern int dflag;
+extern int pflag;
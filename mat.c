@@ -3,21 +3,48 @@
 
 void mat_zero(t_mat *mat)
 {
-  memset(mat->mem, 0, sizeof (int) * mat->n_rows * mat->n_cols);
+  memset(mat->mem, 0, sizeof (t_gf_elt) * mat->n_rows * mat->n_cols);
 }
 
-t_mat *mat_xcalloc(u_int n_rows, u_int n_cols)
+/*
+ * like mat_xcalloc but returns NULL instead of exiting, for library use
+ */
+t_mat *mat_calloc(u_int n_rows, u_int n_cols)
 {
   t_mat *mat;
 
-  mat = xmalloc(sizeof (*mat));
+  if (NULL == (mat = malloc(sizeof (*mat))))
+    return NULL;
   mat->n_rows = n_rows;
   mat->n_cols = n_cols;
-  mat->mem = xmalloc(sizeof (int) * n_rows * n_cols);
+  //never ask malloc for 0 bytes so that NULL always means ENOMEM
+  if (NULL == (mat->mem = malloc(sizeof (t_gf_elt) * n_rows * n_cols + 1))) {
+    free(mat);
+    return NULL;
+  }
   mat_zero(mat);
   return mat;
 }
 
+t_mat *mat_xcalloc(u_int n_rows, u_int n_cols)
+{
+  t_mat *mat;
+
+  if (NULL == (mat = mat_calloc(n_rows, n_cols)))
+    xperror("malloc");
+  return mat;
+}
+
+t_mat *mat_dup(t_mat *mat)
+{
+  t_mat *dup;
+
+  if (NULL == (dup = mat_calloc(mat->n_rows, mat->n_cols)))
+    return NULL;
+  memcpy(dup->mem, mat->mem, sizeof (t_gf_elt) * mat->n_rows * mat->n_cols);
+  return dup;
+}
+
 void mat_free(t_mat *mat)
 {
   if (mat) {
@@ -38,12 +65,29 @@ void mat_dump(t_mat *mat)
   }
 }
 
+/*
+ * copy of the matrix generated at build time for this shape, if any
+ */
+static t_mat *mat_generated(int type, u_int n_rows, u_int n_cols)
+{
+  const t_gf_elt *mem;
+  t_mat *mat;
+
+  if (NULL == (mem = gf_gen_matrix(type, n_rows, n_cols)))
+    return NULL;
+  if (NULL == (mat = mat_calloc(n_rows, n_cols)))
+    return NULL;
+  memcpy(mat->mem, mem, sizeof (t_gf_elt) * n_rows * n_cols);
+  return mat;
+}
+
 t_mat *mat_vandermonde(u_int n_rows, u_int n_cols)
 {
   t_mat *mat;
   int i, j;
   
-  mat = mat_xcalloc(n_rows, n_cols);
+  if (NULL == (mat = mat_calloc(n_rows, n_cols)))
+    return NULL;
   for (i = 0;i < n_rows;i++) {
     for (j = 0;j < n_cols;j++) {
       MAT_ITEM(mat, i, j) = gpow(j + 1, i); 
@@ -55,9 +99,12 @@ t_mat *mat_vandermonde(u_int n_rows, u_int n_cols)
 t_mat *mat_cauchy(u_int n_rows, u_int n_cols)
 {
   t_mat *mat;
-  int i, j;
+  int i, j, f;
 
-  mat = mat_xcalloc(n_rows, n_cols);
+  if (NULL != (mat = mat_generated(EC_MAT_CAUCHY, n_rows, n_cols)))
+    return mat;
+  if (NULL == (mat = mat_calloc(n_rows, n_cols)))
+    return NULL;
   for (i = 0;i < n_rows;i++) {
     for (j = 0;j < n_cols;j++) {
       MAT_ITEM(mat, i, j) = gdiv(1, (i ^ (j + n_rows)));
@@ -65,16 +112,18 @@ t_mat *mat_cauchy(u_int n_rows, u_int n_cols)
   }
 
   /* do optimise */
-  // convert 1st row to all 1s
+  // convert 1st row to all 1s (the pivot is saved before it becomes 1)
   for (j = 0;j < n_cols;j++) {
+    f = MAT_ITEM(mat, 0, j);
     for (i = 0;i < n_rows;i++) {
-      MAT_ITEM(mat, i, j) = gdiv(MAT_ITEM(mat, i, j), MAT_ITEM(mat, 0, j));
+      MAT_ITEM(mat, i, j) = gdiv(MAT_ITEM(mat, i, j), f);
     }
   }
   // convert 1st element of each row to 1
   for (i = 1;i < n_rows;i++) {
+    f = MAT_ITEM(mat, i, 0);
     for (j = 0;j < n_cols;j++) {
-      MAT_ITEM(mat, i, j) = gdiv(MAT_ITEM(mat, i, j), MAT_ITEM(mat, i, 0));
+      MAT_ITEM(mat, i, j) = gdiv(MAT_ITEM(mat, i, j), f);
     }
   }
 
@@ -130,134 +179,196 @@ void mat_transform2(t_mat *tmp, int i, int j)
   }
 }
 
+/*
+ * the column transformations of the paper are made on the transposed
+ * matrix, where they become row operations for gf_row_mul: column i of
+ * the dim x n_cols Vandermonde matrix is row i of t
+ */
 t_mat *mat_vandermonde_correct(u_int n_rows, u_int n_cols)
 {
-  t_mat *mat, *tmp;
-  int i, j, dim;
+  t_mat *mat, *t;
+  int i, j, dim, f;
   
+  if (NULL != (mat = mat_generated(EC_MAT_VANDERMONDE, n_rows, n_cols)))
+    return mat;
   dim = n_rows + n_cols;
-  tmp = mat_xcalloc(dim, n_cols);
+  if (NULL == (t = mat_calloc(n_cols, dim)))
+    return NULL;
   for (i = 0;i < dim;i++) {
     for (j = 0;j < n_cols;j++) {
-      MAT_ITEM(tmp, i, j) = gpow(i, j); 
+      MAT_ITEM(t, j, i) = gpow(i, j); 
     }
   }
 
   /* perform transformations to get the identity matrix on the top rows */
-  i = 0;
-  while (i < n_cols) {
-    
-    if (mat_check_row_is_identity(tmp, i)) {
-      i++;
-      continue ;
-    }
-    
-    //this case is mentionned in the paper but cannot happen
-    /* if (0 == MAT_ITEM(tmp, i, i)) {
-       for (j = i + 1;j < tmp->n_cols;j++) {
-       if (0 != MAT_ITEM(tmp, i, j)) {
-       mat_swap_cols(tmp, i, j);
-       continue ;
-       }
-       } */
-    
-    //check if f_i_i == 1
-    if (1 != MAT_ITEM(tmp, i, i)) {
-      //check for inverse since f_i_i != 0
-      mat_transform1(tmp, i);
-    }
-    
-    //now f_i_i == 1
-    for (j = 0;j < tmp->n_cols;j++) {
-      if (i != j) {
-        if (0 != MAT_ITEM(tmp, i, j)) {
-          mat_transform2(tmp, i, j);
-        }
-      }
+  for (i = 0;i < n_cols;i++) {
+    //the columns before i are already those of the identity
+    if (1 != (f = MAT_ITEM(t, i, i)))
+      gf_row_mul(&MAT_ITEM(t, i, i), &MAT_ITEM(t, i, i), gdiv(1, f),
+                 dim - i, 0);
+    for (j = 0;j < n_cols;j++) {
+      if (i != j && 0 != (f = MAT_ITEM(t, j, i)))
+        gf_row_mul(&MAT_ITEM(t, j, i), &MAT_ITEM(t, i, i), f, dim - i, 1);
     }
-    
-    i++;
   }
 
-  mat = mat_xcalloc(n_rows, n_cols);
+  if (NULL == (mat = mat_calloc(n_rows, n_cols))) {
+    mat_free(t);
+    return NULL;
+  }
 
-  //copy last n_rows rows of tmp into mat
+  //copy last n_rows rows of the transformed matrix into mat
   for (i = 0;i < n_rows;i++) {
     for (j = 0;j < n_cols;j++) {
-      MAT_ITEM(mat, i, j) = MAT_ITEM(tmp, n_cols + i, j);
+      MAT_ITEM(mat, i, j) = MAT_ITEM(t, j, n_cols + i);
     }
   }
 
-  free(tmp);
+  mat_free(t);
   return mat;
 }
 
-void mat_inv(t_mat *mat)
+/** 
+ * invert a square matrix in place by Gauss-Jordan elimination. Every
+ * non-zero element of a field is as good a pivot as any other, so the
+ * first one is taken; rows with a zero in the pivot column are left alone
+ * and the others are updated with the row operations of gf_row_mul from
+ * the pivot column on.
+ * 
+ * @param mat matrix
+ * 
+ * @return 0 on success, -1 if mat is singular, -2 if out of memory
+ */
+int mat_inv(t_mat *mat)
 {
   t_mat *aug;
-  int dim, i, j, k, tpos, tval, r;
+  int dim, i, j, tpos, r;
 
   assert(mat->n_rows == mat->n_cols);
   dim = mat->n_rows;
-  aug = mat_xcalloc(dim, dim * 2);
+  if (NULL == (aug = mat_calloc(dim + 1, dim * 2)))
+    return -2;
 
   for (i = 0;i < dim;i++) {
-    for (j = 0;j < dim;j++) {
-      MAT_ITEM(aug, i, j) = MAT_ITEM(mat, i, j);
-    }
+    memcpy(&MAT_ITEM(aug, i, 0), &MAT_ITEM(mat, i, 0),
+           sizeof (t_gf_elt) * dim);
+    MAT_ITEM(aug, i, dim + i) = 1;
   }
 
-  for (i = 0;i < dim;i++) {
-    for (j = dim;j < 2*dim;j++) {
-      if (i == (j % dim))
-        MAT_ITEM(aug, i, j) = 1;
-      else
-        MAT_ITEM(aug, i, j) = 0;
-    }
-  }
-
-  /* using gauss-jordan elimination */
   for (j = 0;j < dim;j++) {
-    tpos = j;
-    
-    /* finding maximum jth column element in last (dimension-j) rows */
-    for (i = j+1;i < dim;i++) {
-      if (MAT_ITEM(aug, i, j) > MAT_ITEM(aug, tpos, j))
-        tpos = i;
+    for (tpos = j;tpos < dim && 0 == MAT_ITEM(aug, tpos, j);tpos++)
+      ;
+    if (tpos == dim) {
+      mat_free(aug);
+      return -1;
     }
-    
-    /* swapping row which has maximum jth column element */
+
+    /* swapping through the spare last row */
     if (tpos != j) {
-      for (k=0;k < 2*dim;k++) {
-        tval = MAT_ITEM(aug, j, k);
-        MAT_ITEM(aug, j, k) = MAT_ITEM(aug, tpos, k);
-        MAT_ITEM(aug, tpos, k) = tval;
-      }
+      memcpy(&MAT_ITEM(aug, dim, j), &MAT_ITEM(aug, j, j),
+             sizeof (t_gf_elt) * (2 * dim - j));
+      memcpy(&MAT_ITEM(aug, j, j), &MAT_ITEM(aug, tpos, j),
+             sizeof (t_gf_elt) * (2 * dim - j));
+      memcpy(&MAT_ITEM(aug, tpos, j), &MAT_ITEM(aug, dim, j),
+             sizeof (t_gf_elt) * (2 * dim - j));
     }
-    
-    /* performing row operations to form required identity matrix out of the input matrix */
+
+    /* the columns before j are already 0 in row j */
+    if (1 != (r = MAT_ITEM(aug, j, j)))
+      gf_row_mul(&MAT_ITEM(aug, j, j), &MAT_ITEM(aug, j, j), gdiv(1, r),
+                 2 * dim - j, 0);
     for (i = 0;i < dim;i++) {
-      if (i != j) {
-        r = MAT_ITEM(aug, i, j);
-        for (k = 0;k < 2*dim;k++) {
-          MAT_ITEM(aug, i, k) ^= gmul(gdiv(MAT_ITEM(aug, j, k), MAT_ITEM(aug, j, j)), r);
-        }
-      } else {
-        r = MAT_ITEM(aug, i, j);
-        for (k = 0;k < 2*dim;k++) {
-          MAT_ITEM(aug, i, k) = gdiv(MAT_ITEM(aug, i, k), r);
-        }
-      }
+      if (i != j && 0 != (r = MAT_ITEM(aug, i, j)))
+        gf_row_mul(&MAT_ITEM(aug, i, j), &MAT_ITEM(aug, j, j), r,
+                   2 * dim - j, 1);
     }
   }
 
-  for (i = 0;i < dim;i++) {
-    for (j = 0;j < dim;j++) {
-      MAT_ITEM(mat, i, j) = MAT_ITEM(aug, i, dim + j);
+  for (i = 0;i < dim;i++)
+    memcpy(&MAT_ITEM(mat, i, 0), &MAT_ITEM(aug, i, dim),
+           sizeof (t_gf_elt) * dim);
+
+  mat_free(aug);
+  return 0;
+}
+
+/** 
+ * invert in place an a_prime built by mat_a_prime. The rows of the data
+ * fragments used are rows of the identity, so with e codings among the
+ * rows only the e x e block of the codings over the missing data is
+ * inverted: the missing data are the inverse of that block times the
+ * codings once the contribution of the data present is added in. That is
+ * O(e^2 n + e^3) instead of the O(n^3) of mat_inv.
+ * 
+ * @param a_prime matrix built by mat_a_prime
+ * @param rows fragments of the rows of a_prime, as given to mat_a_prime
+ * 
+ * @return 0 on success, -1 if a_prime is singular, -2 if out of memory
+ */
+int mat_inv_a_prime(t_mat *a_prime, int *rows)
+{
+  int n = a_prime->n_cols;
+  int pos[n];       /* row of data j in a_prime, -1 if missing */
+  int missing[n];
+  int codings[n];   /* rows of the codings in a_prime */
+  t_gf_elt acc[n];
+  t_mat *b, *inv;
+  int e, n_codings, j, k, t, q, ret;
+
+  for (j = 0;j < n;j++)
+    pos[j] = -1;
+  n_codings = 0;
+  for (k = 0;k < n;k++) {
+    if (rows[k] < n)
+      pos[rows[k]] = k;
+    else
+      codings[n_codings++] = k;
+  }
+  e = 0;
+  for (j = 0;j < n;j++) {
+    if (-1 == pos[j])
+      missing[e++] = j;
+  }
+  //a data used twice leaves one more missing than codings
+  if (e != n_codings)
+    return -1;
+
+  if (NULL == (b = mat_calloc(e, e)))
+    return -2;
+  for (q = 0;q < e;q++) {
+    for (t = 0;t < e;t++)
+      MAT_ITEM(b, q, t) = MAT_ITEM(a_prime, codings[q], missing[t]);
+  }
+  if (0 != (ret = mat_inv(b))) {
+    mat_free(b);
+    return ret;
+  }
+  if (NULL == (inv = mat_calloc(n, n))) {
+    mat_free(b);
+    return -2;
+  }
+
+  for (j = 0;j < n;j++) {
+    if (-1 != pos[j])
+      MAT_ITEM(inv, j, pos[j]) = 1;
+  }
+  for (t = 0;t < e;t++) {
+    memset(acc, 0, sizeof (acc));
+    for (q = 0;q < e;q++) {
+      MAT_ITEM(inv, missing[t], codings[q]) = MAT_ITEM(b, t, q);
+      gf_row_mul(acc, &MAT_ITEM(a_prime, codings[q], 0), MAT_ITEM(b, t, q),
+                 n, 1);
+    }
+    for (j = 0;j < n;j++) {
+      if (-1 != pos[j])
+        MAT_ITEM(inv, missing[t], pos[j]) = acc[j];
     }
   }
 
-  mat_free(aug);
+  memcpy(a_prime->mem, inv->mem, sizeof (t_gf_elt) * n * n);
+  mat_free(inv);
+  mat_free(b);
+  return 0;
 }
 
 void mat_mult(t_vec *output, t_mat *a, t_vec *b)
@@ -277,3 +388,203 @@ void mat_mult(t_vec *output, t_mat *a, t_vec *b)
   }
 }
 
+
+/** 
+ * out = a * in over regions, tile by tile: each tile of every input is
+ * read once and accumulated into the matching tiles of up to
+ * MAT_MULTI_MAX outputs at a time, which stay in cache until done
+ * 
+ * @param n_rows number of outputs
+ * @param n_cols number of inputs
+ * @param t tables of the elements of a, column by column: t[j * n_rows + i]
+ *   for a[i][j]
+ * @param in n_cols input regions
+ * @param out n_rows output regions
+ * @param len length of every region in bytes
+ */
+void mat_mult_region_tables(u_int n_rows, u_int n_cols, const t_gf_tables *t,
+                            u_char **in, u_char **out, size_t len)
+{
+  u_char *dst[MAT_MULTI_MAX];
+  size_t off, l;
+  int i, j, g, n;
+
+  for (off = 0;off < len;off += MAT_TILE_SIZE) {
+    l = len - off;
+    if (l > MAT_TILE_SIZE)
+      l = MAT_TILE_SIZE;
+    for (g = 0;g < n_rows;g += MAT_MULTI_MAX) {
+      n = n_rows - g;
+      if (n > MAT_MULTI_MAX)
+        n = MAT_MULTI_MAX;
+      for (i = 0;i < n;i++)
+        dst[i] = out[g + i] + off;
+      for (j = 0;j < n_cols;j++)
+        gf_region_mul_multi(dst, in[j] + off, &t[j * n_rows + g], n, l, j > 0);
+    }
+  }
+}
+
+/** 
+ * region version of mat_mult: out[i] = sum_j a[i][j] * in[j]
+ * 
+ * @param a matrix
+ * @param in a->n_cols input regions
+ * @param out a->n_rows output regions, NULL entries are skipped
+ * @param len length of every region in bytes
+ */
+void mat_mult_region(t_mat *a, u_char **in, u_char **out, size_t len)
+{
+  t_gf_tables *t;
+  u_char *dst[a->n_rows];
+  int rows[a->n_rows];
+  int i, j, n = 0;
+
+  for (i = 0;i < a->n_rows;i++) {
+    if (NULL != out[i]) {
+      rows[n] = i;
+      dst[n++] = out[i];
+    }
+  }
+  if (NULL == (t = malloc(sizeof (t_gf_tables) * n * a->n_cols + 1))) {
+    //one pass per output, no tables to keep
+    for (i = 0;i < n;i++) {
+      gf_region_mul(dst[i], in[0], MAT_ITEM(a, rows[i], 0), len);
+      for (j = 1;j < a->n_cols;j++)
+        gf_region_mul_xor(dst[i], in[j], MAT_ITEM(a, rows[i], j), len);
+    }
+    return ;
+  }
+  for (j = 0;j < a->n_cols;j++)
+    for (i = 0;i < n;i++)
+      gf_tables_init(&t[j * n + i], MAT_ITEM(a, rows[i], j));
+  mat_mult_region_tables(n, a->n_cols, t, in, dst, len);
+  free(t);
+}
+
+/** 
+ * a_prime: the rows of the full (identity + coding) generator matrix that
+ * correspond to the fragments used for decoding
+ * 
+ * @param mat encoding matrix
+ * @param rows n_cols fragments: rows[k] < n_cols stands for data rows[k],
+ *   otherwise for coding rows[k] - n_cols
+ * 
+ * @return a_prime, or NULL if out of memory
+ */
+t_mat *mat_a_prime(t_mat *mat, int *rows)
+{
+  t_mat *a_prime;
+  int k, j;
+
+  if (NULL == (a_prime = mat_calloc(mat->n_cols, mat->n_cols)))
+    return NULL;
+  for (k = 0;k < mat->n_cols;k++) {
+    for (j = 0;j < mat->n_cols;j++) {
+      if (rows[k] < mat->n_cols)
+        MAT_ITEM(a_prime, k, j) = (rows[k] == j) ? 1 : 0;
+      else
+        MAT_ITEM(a_prime, k, j) = MAT_ITEM(mat, rows[k] - mat->n_cols, j);
+    }
+  }
+  return a_prime;
+}
+
+/** 
+ * rows producing lost fragments from the fragments a_prime was built on:
+ * the row of the inverse for a lost data, the encoding row times the
+ * inverse for a lost coding
+ * 
+ * @param mat encoding matrix
+ * @param inv inverse of a_prime
+ * @param lost fragments to produce, numbered as in mat_a_prime
+ * @param n_lost number of lost fragments
+ * 
+ * @return a n_lost x n_cols matrix, or NULL if out of memory
+ */
+t_mat *mat_repair(t_mat *mat, t_mat *inv, int *lost, int n_lost)
+{
+  t_mat *rep;
+  int i, j, k, l;
+
+  if (NULL == (rep = mat_calloc(n_lost, mat->n_cols)))
+    return NULL;
+  for (l = 0;l < n_lost;l++) {
+    if (lost[l] < mat->n_cols) {
+      for (k = 0;k < mat->n_cols;k++)
+        MAT_ITEM(rep, l, k) = MAT_ITEM(inv, lost[l], k);
+    } else {
+      i = lost[l] - mat->n_cols;
+      for (k = 0;k < mat->n_cols;k++) {
+        for (j = 0;j < mat->n_cols;j++)
+          MAT_ITEM(rep, l, k) ^= gmul(MAT_ITEM(mat, i, j), MAT_ITEM(inv, j, k));
+      }
+    }
+  }
+  return rep;
+}
+
+/** 
+ * add local parities to an encoding matrix: the data fragments are cut
+ * into n_groups groups of consecutive fragments, and the local parity of
+ * a group is the XOR of its fragments, so that a single loss in a group
+ * is repaired from the group alone
+ * 
+ * @param mat encoding matrix of the global parities
+ * @param n_groups number of groups, at most n_cols
+ * 
+ * @return the global rows followed by one row per group, or NULL if out
+ *   of memory
+ */
+t_mat *mat_lrc(t_mat *mat, u_int n_groups)
+{
+  t_mat *lrc;
+  int i, j;
+
+  assert(n_groups > 0 && n_groups <= mat->n_cols);
+  if (NULL == (lrc = mat_calloc(mat->n_rows + n_groups, mat->n_cols)))
+    return NULL;
+  memcpy(lrc->mem, mat->mem,
+         sizeof (t_gf_elt) * mat->n_rows * mat->n_cols);
+  for (j = 0;j < mat->n_cols;j++) {
+    i = mat->n_rows + j * n_groups / mat->n_cols;
+    MAT_ITEM(lrc, i, j) = 1;
+  }
+  return lrc;
+}
+
+/** 
+ * add a row to a set of independent rows kept in echelon form: each row
+ * has a 1 at its pivot column and 0 at the pivots of the rows before it
+ * 
+ * @param basis rows so far, n_cols x n_cols
+ * @param pivots pivot column of each row of basis
+ * @param rank number of rows of basis in use
+ * @param row candidate row of basis->n_cols elements
+ * 
+ * @return 1 if row is independent of basis and was added, 0 otherwise
+ */
+int mat_add_independent(t_mat *basis, int *pivots, int rank,
+                        const t_gf_elt *row)
+{
+  t_gf_elt *tmp = &MAT_ITEM(basis, rank, 0);
+  int r, k, c;
+
+  assert(rank < basis->n_rows);
+  memcpy(tmp, row, sizeof (t_gf_elt) * basis->n_cols);
+  for (r = 0;r < rank;r++) {
+    if (0 == (c = tmp[pivots[r]]))
+      continue ;
+    for (k = 0;k < basis->n_cols;k++)
+      tmp[k] ^= gmul(c, MAT_ITEM(basis, r, k));
+  }
+  for (k = 0;k < basis->n_cols && 0 == tmp[k];k++)
+    ;
+  if (k == basis->n_cols)
+    return 0;
+  c = tmp[k];
+  for (r = 0;r < basis->n_cols;r++)
+    tmp[r] = gdiv(tmp[r], c);
+  pivots[rank] = k;
+  return 1;
+}
@@ -9,12 +9,19 @@ typedef struct s_mat
 {
   u_int n_rows;
   u_int n_cols;
-  int *mem;
+  t_gf_elt *mem;
 #define MAT_ITEM(mat, i, j) ((mat)->mem[(i) * (mat)->n_cols + (j)])
 } t_mat;
 
+/* tile of the regions multiplied while staying in cache */
+#define MAT_TILE_SIZE (16 * 1024)
+/* max outputs accumulated together */
+#define MAT_MULTI_MAX 8
+
 extern void mat_zero(t_mat *mat);
+extern t_mat *mat_calloc(u_int n_rows, u_int n_cols);
 extern t_mat *mat_xcalloc(u_int n_rows, u_int n_cols);
+extern t_mat *mat_dup(t_mat *mat);
 extern void mat_free(t_mat *mat);
 extern void mat_dump(t_mat *mat);
 extern t_mat *mat_vandermonde(u_int n_rows, u_int n_cols);
@@ -24,5 +31,15 @@ extern void mat_swap_cols(t_mat *mat, int c1, int c2);
 extern void mat_transform1(t_mat *tmp, int i);
 extern void mat_transform2(t_mat *tmp, int i, int j);
 extern t_mat *mat_vandermonde_correct(u_int n_rows, u_int n_cols);
-extern void mat_inv(t_mat *mat);
+extern int mat_inv(t_mat *mat);
+extern int mat_inv_a_prime(t_mat *a_prime, int *rows);
 extern void mat_mult(t_vec *output, t_mat *a, t_vec *b);
+extern t_mat *mat_a_prime(t_mat *mat, int *rows);
+extern t_mat *mat_repair(t_mat *mat, t_mat *inv, int *lost, int n_lost);
+extern t_mat *mat_lrc(t_mat *mat, u_int n_groups);
+extern int mat_add_independent(t_mat *basis, int *pivots, int rank,
+                               const t_gf_elt *row);
+extern void mat_mult_region_tables(u_int n_rows, u_int n_cols,
+                                   const t_gf_tables *t, u_char **in,
+                                   u_char **out, size_t len);
+extern void mat_mult_region(t_mat *a, u_char **in, u_char **out, size_t len);
@@ -1,6 +1,14 @@
 
+#define _GNU_SOURCE     /* SEEK_DATA, fallocate */
 #include "ec.h"
 
+/* bytes OR-ed together per step of mem_is_zero */
+#define ZERO_CHUNK 256
+
+#ifndef IOV_MAX
+# define IOV_MAX 1024
+#endif
+
 void xperror(char *str)
 {
   perror(str);
@@ -37,3 +45,157 @@ char *xstrdup(char *str)
   return n;
 }
 
+
+/*
+ * read up to count bytes, stopping early only at end of file
+ */
+size_t xread(int fd, void *buf, size_t count)
+{
+  ssize_t ret;
+  size_t done = 0;
+
+  while (done < count) {
+    if (-1 == (ret = read(fd, (char *) buf + done, count - done))) {
+      if (EINTR == errno)
+        continue ;
+      xperror("read");
+    }
+    if (0 == ret)
+      break ;
+    done += ret;
+  }
+  return done;
+}
+
+/*
+ * write all the iovecs, which are consumed in the process
+ */
+void xwritev(int fd, struct iovec *iov, int iovcnt)
+{
+  ssize_t ret;
+
+  while (iovcnt > 0) {
+    if (-1 == (ret = writev(fd, iov, (iovcnt > IOV_MAX) ? IOV_MAX : iovcnt))) {
+      if (EINTR == errno)
+        continue ;
+      xperror("writev");
+    }
+    while (iovcnt > 0 && ret >= iov->iov_len) {
+      ret -= iov->iov_len;
+      iov++;
+      iovcnt--;
+    }
+    if (ret > 0) {
+      iov->iov_base = (char *) iov->iov_base + ret;
+      iov->iov_len -= ret;
+    }
+  }
+}
+
+/*
+ * read exactly count bytes at offset, exit on error or short read
+ */
+void xpread(int fd, void *buf, size_t count, off_t offset)
+{
+  ssize_t ret;
+
+  while (count > 0) {
+    if (-1 == (ret = pread(fd, buf, count, offset))) {
+      if (EINTR == errno)
+        continue ;
+      xperror("pread");
+    }
+    if (0 == ret)
+      xmsg("short read", "");
+    buf = (char *) buf + ret;
+    count -= ret;
+    offset += ret;
+  }
+}
+
+/*
+ * write exactly count bytes at offset, exit on error
+ */
+void xpwrite(int fd, const void *buf, size_t count, off_t offset)
+{
+  ssize_t ret;
+
+  while (count > 0) {
+    if (-1 == (ret = pwrite(fd, buf, count, offset))) {
+      if (EINTR == errno)
+        continue ;
+      xperror("pwrite");
+    }
+    buf = (const char *) buf + ret;
+    count -= ret;
+    offset += ret;
+  }
+}
+
+/*
+ * whether len bytes of buf are all zeros. Words are OR-ed together by
+ * chunks, a loop the compiler vectorizes, and a chunk with a bit set ends
+ * the scan early, so that data costs about one chunk.
+ */
+int mem_is_zero(const void *buf, size_t len)
+{
+  const u_char *p = buf;
+  const unsigned long *w;
+  unsigned long acc;
+  int i;
+
+  for (;len > 0 && 0 != ((size_t) p % sizeof (*w));len--) {
+    if (0 != *p++)
+      return 0;
+  }
+  for (;len >= ZERO_CHUNK;len -= ZERO_CHUNK, p += ZERO_CHUNK) {
+    w = (const unsigned long *) p;
+    acc = 0;
+    for (i = 0;i < ZERO_CHUNK / sizeof (*w);i++)
+      acc |= w[i];
+    if (0 != acc)
+      return 0;
+  }
+  for (;len > 0;len--) {
+    if (0 != *p++)
+      return 0;
+  }
+  return 1;
+}
+
+/*
+ * whether [offset, offset + count[ of fd lies in a hole, as far as the
+ * file system tells: 0 when it cannot
+ */
+int fd_is_hole(int fd, off_t offset, size_t count)
+{
+  off_t data;
+
+  if (-1 == (data = lseek(fd, offset, SEEK_DATA)))
+    return ENXIO == errno;    //no data past offset
+  return data >= offset + count;
+}
+
+/*
+ * deallocate count bytes of fd at offset, which then read as zeros, the
+ * size being kept: 0, or -1 if the file system cannot punch holes
+ */
+int fd_punch_hole(int fd, off_t offset, size_t count)
+{
+  if (0 == count)
+    return 0;
+  return fallocate(fd, FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE, offset,
+                   count);
+}
+
+/*
+ * map size bytes of fd shared, exit on error
+ */
+void *xmmap(int fd, size_t size, int prot)
+{
+  void *p;
+
+  if (MAP_FAILED == (p = mmap(NULL, size, prot, MAP_SHARED, fd, 0)))
+    xperror("mmap");
+  return p;
+}
@@ -4,3 +4,11 @@ extern void xerrormsg(char *str1, char *str2);
 extern void xmsg(char *str1, char *str2);
 extern void *xmalloc(size_t size);
 extern char *xstrdup(char *str);
+extern size_t xread(int fd, void *buf, size_t count);
+extern void xwritev(int fd, struct iovec *iov, int iovcnt);
+extern void xpread(int fd, void *buf, size_t count, off_t offset);
+extern void xpwrite(int fd, const void *buf, size_t count, off_t offset);
+extern int mem_is_zero(const void *buf, size_t len);
+extern int fd_is_hole(int fd, off_t offset, size_t count);
+extern int fd_punch_hole(int fd, off_t offset, size_t count);
+extern void *xmmap(int fd, size_t size, int prot);
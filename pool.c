@@ -0,0 +1,67 @@
+/**
+ * @file   pool.c
+ *
+ * @brief  Pool of EC_BLOCK_SIZE buffers
+ *         Buffers are carved out of slabs mapped once, preferably on huge
+ *         pages, so they are page aligned as O_DIRECT wants them. Released
+ *         buffers go back to a free list and are never unmapped.
+ */
+
+#include "ec.h"
+
+#define POOL_SLAB 8     /* buffers mapped at once */
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static void *pool_free = NULL;  /* free list, linked through the buffers */
+
+/*
+ * map a slab and chain its buffers into the free list, with pool_lock held
+ */
+static void pool_grow()
+{
+  size_t size = POOL_SLAB * EC_BLOCK_SIZE;
+  u_char *slab;
+  int i;
+
+  slab = mmap(NULL, size, PROT_READ|PROT_WRITE,
+              MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+  if (MAP_FAILED == slab) {
+    //no reserved huge pages, ask for transparent ones
+    slab = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS,
+                -1, 0);
+    if (MAP_FAILED == slab)
+      xperror("mmap");
+    madvise(slab, size, MADV_HUGEPAGE);
+  }
+  for (i = 0;i < POOL_SLAB;i++) {
+    *(void **) (slab + i * EC_BLOCK_SIZE) = pool_free;
+    pool_free = slab + i * EC_BLOCK_SIZE;
+  }
+}
+
+/**
+ * @return a buffer of EC_BLOCK_SIZE bytes aligned on EC_DIRECT_ALIGN,
+ *   exit if out of memory
+ */
+u_char *pool_get()
+{
+  u_char *buf;
+
+  pthread_mutex_lock(&pool_lock);
+  if (NULL == pool_free)
+    pool_grow();
+  buf = pool_free;
+  pool_free = *(void **) buf;
+  pthread_mutex_unlock(&pool_lock);
+  return buf;
+}
+
+void pool_put(u_char *buf)
+{
+  if (NULL == buf)
+    return ;
+  pthread_mutex_lock(&pool_lock);
+  *(void **) buf = pool_free;
+  pool_free = buf;
+  pthread_mutex_unlock(&pool_lock);
+}
@@ -0,0 +1,7 @@
+/* alignment of the pool buffers, enough for O_DIRECT */
+#define EC_DIRECT_ALIGN 4096
+#define EC_DIRECT_ROUND(len) \
+  (((len) + EC_DIRECT_ALIGN - 1) & ~(size_t) (EC_DIRECT_ALIGN - 1))
+
+extern u_char *pool_get();
+extern void pool_put(u_char *buf);
@@ -0,0 +1,303 @@
+/**
+ * @file   stream.c
+ * 
+ * @brief  Single object streaming mode
+ *         The object is cut in cells striped round-robin over the k data
+ *         fragments, cell c going to data c % k at offset (c / k) * cell.
+ *         Each stripe of k cells gets m coding cells. The object is padded
+ *         with 0x80 then zeros up to the end of a stripe, so its length can
+ *         be recovered from the fragments alone.
+ */
+
+#include "ec.h"
+
+#define PAD_MARKER 0x80
+
+/*
+ * number of stripes handled per batch: about EC_BLOCK_SIZE per fragment
+ */
+static size_t batch_stripes(size_t cell)
+{
+  return (cell >= EC_BLOCK_SIZE) ? 1 : EC_BLOCK_SIZE / cell;
+}
+
+/*
+ * kernel tables of mat, column by column as mat_mult_region_tables wants
+ * them, built once per stream rather than once per cell
+ */
+static t_gf_tables *stream_tables(t_mat *mat)
+{
+  t_gf_tables *t;
+  int i, j;
+
+  t = xmalloc(sizeof (t_gf_tables) * mat->n_rows * mat->n_cols);
+  for (j = 0;j < mat->n_cols;j++)
+    for (i = 0;i < mat->n_rows;i++)
+      gf_tables_init(&t[j * mat->n_rows + i], MAT_ITEM(mat, i, j));
+  return t;
+}
+
+/** 
+ * split an object into prefix.d0 ... and encode prefix.c0 ... on the fly
+ * 
+ * @param prefix prefix of files
+ * @param mat encoding matrix
+ * @param input object to split, "-" for stdin
+ * @param cell cell size, a multiple of the word size
+ */
+void encode_stream(char *prefix, t_mat *mat, char *input, size_t cell)
+{
+  int i, j, s;
+  int in_fd;
+  int d_fds[mat->n_cols];
+  int c_fds[mat->n_rows];
+  char filename[1024];
+  size_t stripe = mat->n_cols * cell;
+  size_t nb = batch_stripes(cell);
+  size_t len, end;
+  u_char *buf;
+  u_char *parity[mat->n_rows];
+  u_char *in[mat->n_cols];
+  u_char *out[mat->n_rows];
+  t_gf_tables *tables;
+  struct iovec *iov;
+  int done = 0;
+
+  if (0 == cell || alignw(cell) != cell)
+    xmsg("cell size not aligned on words", "");
+
+  if (0 == strcmp(input, "-"))
+    in_fd = 0;
+  else if (-1 == (in_fd = open(input, O_RDONLY)))
+    xerrormsg("error opening", input);
+
+  for (j = 0;j < mat->n_cols;j++) {
+    snprintf(filename, sizeof (filename), "%s.d%d", prefix, j);
+    if (-1 == (d_fds[j] = open(filename, O_WRONLY|O_CREAT|O_TRUNC, 0666)))
+      xerrormsg("error opening", filename);
+  }
+  for (i = 0;i < mat->n_rows;i++) {
+    snprintf(filename, sizeof (filename), "%s.c%d", prefix, i);
+    if (-1 == (c_fds[i] = open(filename, O_WRONLY|O_CREAT|O_TRUNC, 0666)))
+      xerrormsg("error opening", filename);
+  }
+
+  buf = xmalloc(nb * stripe);
+  for (i = 0;i < mat->n_rows;i++)
+    parity[i] = xmalloc(nb * cell);
+  iov = xmalloc(sizeof (*iov) * nb);
+  tables = stream_tables(mat);
+
+  while (!done) {
+    len = xread(in_fd, buf, nb * stripe);
+    if (len < nb * stripe) {
+      //end of object: pad up to the end of the stripe
+      end = (len / stripe + 1) * stripe;
+      buf[len] = PAD_MARKER;
+      memset(buf + len + 1, 0, end - len - 1);
+      len = end;
+      done = 1;
+    }
+
+    //cells are used in place in the input buffer
+    for (s = 0;s < len / stripe;s++) {
+      for (j = 0;j < mat->n_cols;j++)
+        in[j] = buf + s * stripe + j * cell;
+      for (i = 0;i < mat->n_rows;i++)
+        out[i] = parity[i] + s * cell;
+      mat_mult_region_tables(mat->n_rows, mat->n_cols, tables, in, out,
+                             cell);
+    }
+
+    for (j = 0;j < mat->n_cols;j++) {
+      for (s = 0;s < len / stripe;s++) {
+        iov[s].iov_base = buf + s * stripe + j * cell;
+        iov[s].iov_len = cell;
+      }
+      xwritev(d_fds[j], iov, len / stripe);
+    }
+    for (i = 0;i < mat->n_rows;i++) {
+      iov[0].iov_base = parity[i];
+      iov[0].iov_len = len / stripe * cell;
+      xwritev(c_fds[i], iov, 1);
+    }
+  }
+
+  free(tables);
+  free(iov);
+  for (i = 0;i < mat->n_rows;i++)
+    free(parity[i]);
+  free(buf);
+
+  for (j = 0;j < mat->n_cols;j++)
+    close(d_fds[j]);
+  for (i = 0;i < mat->n_rows;i++)
+    close(c_fds[i]);
+  if (0 != in_fd)
+    close(in_fd);
+}
+
+/** 
+ * stream the object back to stdout from any n_cols surviving fragments,
+ * computing the cells of the missing data fragments on the fly
+ * 
+ * @param prefix prefix of files
+ * @param mat encoding matrix
+ * @param cell cell size used when splitting
+ * 
+ * @return 0 on success, -1 if too many fragments are missing
+ */
+int decode_stream(char *prefix, t_mat *mat, size_t cell)
+{
+  int i, j, s, k, n_out;
+  int d_fds[mat->n_cols];
+  int c_fds[mat->n_rows];
+  int rows[mat->n_cols];
+  int lost[mat->n_cols];
+  char filename[1024];
+  struct stat stbuf;
+  size_t size = -1;
+  size_t nb = batch_stripes(cell);
+  size_t n_stripes, ns, done, n_iov;
+  u_int n_ok = 0;
+  t_mat *a_prime = NULL;
+  t_mat *rep = NULL;
+  u_char *d_bufs[mat->n_cols];
+  u_char *c_bufs[mat->n_rows];
+  u_char *in[mat->n_cols];
+  u_char *out[mat->n_cols];
+  u_char *last;
+  t_gf_tables *tables = NULL;
+  struct iovec *iov;
+  int ret;
+
+  if (0 == cell || alignw(cell) != cell)
+    xmsg("cell size not aligned on words", "");
+
+  for (j = 0;j < mat->n_cols + mat->n_rows;j++) {
+    if (j < mat->n_cols)
+      snprintf(filename, sizeof (filename), "%s.d%d", prefix, j);
+    else
+      snprintf(filename, sizeof (filename), "%s.c%d", prefix, j - mat->n_cols);
+    if (-1 == (k = open(filename, O_RDONLY))) {
+      if (ENOENT != errno)
+        xerrormsg("error opening", filename);
+      if (vflag)
+        fprintf(stderr, "%s is missing\n", filename);
+    } else {
+      if (-1 == fstat(k, &stbuf))
+        xerrormsg("error stating", filename);
+      if (-1 == size)
+        size = stbuf.st_size;
+      else if (size != stbuf.st_size)
+        xmsg("bad size", filename);
+      n_ok++;
+    }
+    if (j < mat->n_cols)
+      d_fds[j] = k;
+    else
+      c_fds[j - mat->n_cols] = k;
+  }
+
+  if (n_ok < mat->n_cols) {
+    fprintf(stderr, "too many losses\n");
+    ret = -1;
+    goto end;
+  }
+  if (NULL == (a_prime = decode_matrix(mat, d_fds, c_fds, rows))) {
+    fprintf(stderr, "too many losses\n");
+    ret = -1;
+    goto end;
+  }
+  if (0 == size || 0 != size % cell)
+    xmsg("fragment size is not a multiple of the cell size", prefix);
+  n_stripes = size / cell;
+
+  for (j = 0;j < mat->n_cols;j++)
+    d_bufs[j] = xmalloc(nb * cell);
+  for (i = 0;i < mat->n_rows;i++)
+    c_bufs[i] = NULL;
+
+  //rows of the inverse of a_prime producing the missing data
+  n_out = 0;
+  for (j = 0;j < mat->n_cols;j++) {
+    if (-1 == d_fds[j]) {
+      lost[n_out] = j;
+      out[n_out++] = d_bufs[j];
+    }
+  }
+  if (n_out > 0) {
+    if (NULL == (rep = mat_repair(mat, a_prime, lost, n_out)))
+      xperror("malloc");
+    tables = stream_tables(rep);
+  }
+  for (k = 0;k < mat->n_cols;k++) {
+    if (rows[k] < mat->n_cols) {
+      in[k] = d_bufs[rows[k]];
+    } else {
+      i = rows[k] - mat->n_cols;
+      in[k] = c_bufs[i] = xmalloc(nb * cell);
+    }
+  }
+
+  iov = xmalloc(sizeof (*iov) * nb * mat->n_cols);
+  for (done = 0;done < n_stripes;done += ns) {
+    ns = n_stripes - done;
+    if (ns > nb)
+      ns = nb;
+    for (k = 0;k < mat->n_cols;k++) {
+      if (rows[k] < mat->n_cols)
+        xpread(d_fds[rows[k]], in[k], ns * cell, done * cell);
+      else
+        xpread(c_fds[rows[k] - mat->n_cols], in[k], ns * cell, done * cell);
+    }
+    if (n_out > 0)
+      mat_mult_region_tables(rep->n_rows, rep->n_cols, tables, in, out,
+                             ns * cell);
+
+    n_iov = 0;
+    for (s = 0;s < ns;s++) {
+      for (j = 0;j < mat->n_cols;j++) {
+        iov[n_iov].iov_base = d_bufs[j] + s * cell;
+        iov[n_iov].iov_len = cell;
+        n_iov++;
+      }
+    }
+    if (done + ns == n_stripes) {
+      //strip the padding: the marker is the last non-zero byte
+      while (n_iov > 0) {
+        last = iov[n_iov - 1].iov_base;
+        while (iov[n_iov - 1].iov_len > 0 &&
+               0 == last[iov[n_iov - 1].iov_len - 1])
+          iov[n_iov - 1].iov_len--;
+        if (iov[n_iov - 1].iov_len > 0)
+          break ;
+        n_iov--;
+      }
+      if (0 == n_iov || PAD_MARKER != last[iov[n_iov - 1].iov_len - 1])
+        xmsg("bad padding in", prefix);
+      iov[n_iov - 1].iov_len--;
+    }
+    xwritev(1, iov, n_iov);
+  }
+  free(iov);
+
+  for (j = 0;j < mat->n_cols;j++)
+    free(d_bufs[j]);
+  for (i = 0;i < mat->n_rows;i++)
+    free(c_bufs[i]);
+  ret = 0;
+ end:
+  for (j = 0;j < mat->n_cols;j++) {
+    if (-1 != d_fds[j])
+      close(d_fds[j]);
+  }
+  for (i = 0;i < mat->n_rows;i++) {
+    if (-1 != c_fds[i])
+      close(c_fds[i]);
+  }
+  free(tables);
+  mat_free(a_prime);
+  mat_free(rep);
+  return ret;
+}
@@ -0,0 +1,5 @@
+/* default cell size of the streaming mode */
+#define EC_CELL_SIZE 4096
+
+extern void encode_stream(char *prefix, t_mat *mat, char *input, size_t cell);
+extern int decode_stream(char *prefix, t_mat *mat, size_t cell);
@@ -19,14 +19,15 @@ do_test()
     n_coding=$3
     data_loss=$4
     coding_loss=$5
-    extraopts=$6
+    shift 5
+    extraopts=$*
     echo ${bin} n=${n_data} m=${n_coding} data_loss=\"${data_loss}\" coding_loss=\"${coding_loss}\" ${extraopts}
 
     rm -f foo.*
     
     for i in `seq 0 $(expr ${n_data} - 1)`
     do
-        dd if=/dev/urandom of=foo.d${i} bs=1M count=1 > /dev/null 2>&1
+        head -c ${data_size:-1048576} /dev/urandom > foo.d${i}
         md5sum foo.d${i} > foo.d${i}.md5sum.1
     done
     
@@ -66,6 +67,597 @@ do_test()
     done
 }
 
+# lose more fragments than can be rebuilt: the repair must fail without
+# creating any of them, so that a second run fails the same way
+do_loss_test()
+{
+    bin=$1
+    n_data=$2
+    n_coding=$3
+    loss=$4
+    shift 4
+    extraopts=$*
+    echo ${bin} n=${n_data} m=${n_coding} too many losses \"${loss}\" ${extraopts}
+
+    rm -f foo.*
+
+    for i in `seq 0 $(expr ${n_data} - 1)`
+    do
+        head -c ${data_size:-1048576} /dev/urandom > foo.d${i}
+    done
+
+    ${valgrind} ${bin} -n ${n_data} -m ${n_coding} -p foo -c ${extraopts} ${vflag}
+    checkfail "coding generation"
+
+    for f in ${loss}
+    do
+        rm foo.${f}
+    done
+
+    for run in 1 2
+    do
+        ${valgrind} ${bin} -n ${n_data} -m ${n_coding} -p foo -r ${extraopts} ${vflag} 2> foo.out
+        test $? -ne 0
+        checkfail "repair of too many losses"
+        grep -q "too many losses" foo.out
+        checkfail "too many losses not reported"
+        for f in ${loss}
+        do
+            test ! -e foo.${f}
+            checkfail "lost fragment created"
+        done
+    done
+}
+
+# a decode cache file whose record claims a huge matrix must be ignored
+# from there on, not allocated
+do_dcache_corrupt_test()
+{
+    bin=$1
+    shift 1
+    extraopts=$*
+    echo ${bin} corrupt decode cache ${extraopts}
+
+    rm -f foo.*
+
+    for i in 0 1 2 3
+    do
+        head -c 100000 /dev/urandom > foo.d${i}
+    done
+
+    ${valgrind} ${bin} -n 4 -m 2 -p foo -c ${extraopts} ${vflag}
+    checkfail "coding generation"
+    md5sum foo.d0 > foo.md5sum
+    rm foo.d0 foo.*.crc
+
+    # magic, w=8, n_rows=1, n_cols=65535 and a truncated record
+    printf 'EDC2\010\0\0\0\001\0\0\0\377\377\0\0' > foo.cache
+    printf '\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0junk' >> foo.cache
+    ${valgrind} ${bin} -n 4 -m 2 -p foo -r ${extraopts} -C foo.cache ${vflag}
+    checkfail "repairing with a corrupt cache"
+    md5sum -c --quiet foo.md5sum
+    checkfail "data files mismatch"
+
+    # a valid record with a flipped bit in its first element, the 4x4
+    # inverse being the last 64 bytes
+    rm foo.d0 foo.cache
+    ${valgrind} ${bin} -n 4 -m 2 -p foo -r ${extraopts} -C foo.cache ${vflag}
+    checkfail "repairing to fill the cache"
+    rm foo.d0
+    size=$(stat -c %s foo.cache)
+    byte=$(od -An -tu1 -j $((size - 64)) -N 1 foo.cache)
+    printf "$(printf '\\%03o' $((byte ^ 1)))" |
+        dd of=foo.cache bs=1 seek=$((size - 64)) conv=notrunc 2>/dev/null
+    ${valgrind} ${bin} -n 4 -m 2 -p foo -r ${extraopts} -C foo.cache ${vflag}
+    checkfail "repairing with a flipped cache"
+    md5sum -c --quiet foo.md5sum
+    checkfail "data files mismatch"
+}
+
+# overwrite a range of one data file through -U and check that the coding
+# files match a full re-encoding
+do_update_test()
+{
+    bin=$1
+    n_data=$2
+    n_coding=$3
+    index=$4
+    offset=$5
+    length=$6
+    shift 6
+    extraopts=$*
+    echo ${bin} n=${n_data} m=${n_coding} update index=${index} offset=${offset} length=${length} ${extraopts}
+
+    rm -f foo.*
+
+    for i in `seq 0 $(expr ${n_data} - 1)`
+    do
+        dd if=/dev/urandom of=foo.d${i} bs=1M count=1 > /dev/null 2>&1
+    done
+
+    ${valgrind} ${bin} -n ${n_data} -m ${n_coding} -p foo -c ${extraopts} ${vflag}
+    checkfail "coding generation"
+
+    dd if=/dev/urandom of=foo.new bs=${length} count=1 > /dev/null 2>&1
+    ${valgrind} ${bin} -n ${n_data} -m ${n_coding} -p foo -U ${index} -o ${offset} -f foo.new ${extraopts} ${vflag}
+    checkfail "updating"
+
+    # same again with the data file already overwritten
+    dd if=foo.d${index} of=foo.old bs=1 skip=${offset} count=${length} > /dev/null 2>&1
+    dd if=/dev/urandom of=foo.new bs=${length} count=1 > /dev/null 2>&1
+    dd if=foo.new of=foo.d${index} bs=1 seek=${offset} conv=notrunc > /dev/null 2>&1
+    ${valgrind} ${bin} -n ${n_data} -m ${n_coding} -p foo -U ${index} -o ${offset} -f foo.new -O foo.old ${extraopts} ${vflag}
+    checkfail "updating with old contents"
+
+    for i in `seq 0 $(expr ${n_coding} - 1)`
+    do
+        md5sum foo.c${i} > foo.c${i}.md5sum.1
+    done
+
+    ${valgrind} ${bin} -n ${n_data} -m ${n_coding} -p foo -c ${extraopts} ${vflag}
+    checkfail "coding generation"
+
+    for i in `seq 0 $(expr ${n_coding} - 1)`
+    do
+        md5sum foo.c${i} > foo.c${i}.md5sum.2
+        diff foo.c${i}.md5sum.1 foo.c${i}.md5sum.2
+        checkfail "coding files mismatch after update"
+    done
+
+    # the checksums of the updated blocks must have followed
+    ${valgrind} ${bin} -n ${n_data} -m ${n_coding} -p foo -r -v ${extraopts} > /dev/null 2> foo.out
+    checkfail "repairing after update"
+    grep "bad block" foo.out
+    test $? -ne 0
+    checkfail "stale checksums after update"
+}
+
+# encode, check that -V accepts the stripe, then corrupt one byte of a
+# coding file and check that -V reports its offset
+do_verify_test()
+{
+    bin=$1
+    n_data=$2
+    n_coding=$3
+    index=$4
+    offset=$5
+    shift 5
+    extraopts=$*
+    echo ${bin} n=${n_data} m=${n_coding} verify index=${index} offset=${offset} ${extraopts}
+
+    rm -f foo.*
+
+    for i in `seq 0 $(expr ${n_data} - 1)`
+    do
+        head -c ${data_size:-1048576} /dev/urandom > foo.d${i}
+    done
+
+    ${valgrind} ${bin} -n ${n_data} -m ${n_coding} -p foo -c ${extraopts} ${vflag}
+    checkfail "coding generation"
+
+    ${valgrind} ${bin} -n ${n_data} -m ${n_coding} -p foo -V ${extraopts} ${vflag}
+    checkfail "verifying"
+
+    # flip the byte so that it always differs
+    byte=`od -An -tu1 -j ${offset} -N1 foo.c${index}`
+    printf "\\$(printf %o $(( (byte + 1) % 256 )))" | dd of=foo.c${index} bs=1 seek=${offset} conv=notrunc > /dev/null 2>&1
+    ${valgrind} ${bin} -n ${n_data} -m ${n_coding} -p foo -V ${extraopts} ${vflag} 2> foo.out
+    test $? -ne 0
+    checkfail "corruption not detected"
+    grep -q "foo.c${index}: mismatch at offset ${offset}$" foo.out
+    checkfail "corruption offset"
+    test `grep -c mismatch foo.out` -eq 1
+    checkfail "corruption of other coding files"
+
+    # a missing coding file must not make the others mismatch
+    if [ -n "${missing}" ]
+    then
+        rm foo.${missing}
+        ${valgrind} ${bin} -n ${n_data} -m ${n_coding} -p foo -V ${extraopts} ${vflag} 2> foo.out
+        test $? -ne 0
+        checkfail "missing file not detected"
+        grep -q "foo.c${index}: mismatch at offset ${offset}$" foo.out
+        checkfail "corruption offset with a missing file"
+        test `grep -c mismatch foo.out` -eq 1
+        checkfail "mismatch of healthy coding files"
+    fi
+}
+
+# silently corrupt a byte of some fragments, lose others, and check that
+# repair rebuilds the corrupted blocks from their checksums as well
+do_corrupt_test()
+{
+    bin=$1
+    n_data=$2
+    n_coding=$3
+    corrupt=$4
+    offset=$5
+    loss=$6
+    shift 6
+    extraopts=$*
+    echo ${bin} n=${n_data} m=${n_coding} corrupt=\"${corrupt}\" offset=${offset} loss=\"${loss}\" ${extraopts}
+
+    rm -f foo.*
+
+    for i in `seq 0 $(expr ${n_data} - 1)`
+    do
+        head -c ${data_size:-1048576} /dev/urandom > foo.d${i}
+    done
+
+    ${valgrind} ${bin} -n ${n_data} -m ${n_coding} -p foo -c ${extraopts} ${vflag}
+    checkfail "coding generation"
+
+    md5sum foo.d? foo.c? > foo.md5sum
+
+    for f in ${corrupt}
+    do
+        byte=`od -An -tu1 -j ${offset} -N1 foo.${f}`
+        printf "\\$(printf %o $(( (byte + 1) % 256 )))" | dd of=foo.${f} bs=1 seek=${offset} conv=notrunc > /dev/null 2>&1
+    done
+
+    for f in ${loss}
+    do
+        rm foo.${f}
+    done
+
+    ${valgrind} ${bin} -n ${n_data} -m ${n_coding} -p foo -r ${extraopts} ${vflag}
+    checkfail "repairing"
+
+    md5sum -c --quiet foo.md5sum
+    checkfail "fragments mismatch"
+}
+
+# lose some fragments and read a range of a data file with -R, which must
+# match the original without rebuilding anything
+do_range_test()
+{
+    bin=$1
+    n_data=$2
+    n_coding=$3
+    index=$4
+    offset=$5
+    length=$6
+    loss=$7
+    shift 7
+    extraopts=$*
+    echo ${bin} n=${n_data} m=${n_coding} range index=${index} offset=${offset} length=${length} loss=\"${loss}\" ${extraopts}
+
+    rm -f foo.*
+
+    for i in `seq 0 $(expr ${n_data} - 1)`
+    do
+        head -c ${data_size:-1048576} /dev/urandom > foo.d${i}
+    done
+
+    ${valgrind} ${bin} -n ${n_data} -m ${n_coding} -p foo -c ${extraopts} ${vflag}
+    checkfail "coding generation"
+
+    tail -c +$(expr ${offset} + 1) foo.d${index} | head -c ${length} > foo.obj
+
+    for f in ${loss}
+    do
+        rm foo.${f}
+    done
+
+    ${valgrind} ${bin} -n ${n_data} -m ${n_coding} -p foo -R ${index} -o ${offset} -l ${length} ${extraopts} ${vflag} > foo.out
+    checkfail "degraded read"
+
+    cmp foo.obj foo.out
+    checkfail "range mismatch"
+
+    test ! -e foo.d${index}
+    checkfail "data file rebuilt"
+}
+
+# degraded reads on fragments of bad or odd sizes: a fragment whose size
+# does not match is refused, and under W=16 the odd tail byte of a missing
+# data file, not covered by the coding files, is an error
+do_range_size_test()
+{
+    bin=$1
+    n_data=$2
+    n_coding=$3
+    shift 3
+    extraopts=$*
+    echo ${bin} n=${n_data} m=${n_coding} range sizes ${extraopts}
+
+    rm -f foo.*
+
+    for i in `seq 0 $(expr ${n_data} - 1)`
+    do
+        head -c 100001 /dev/urandom > foo.d${i}
+    done
+
+    # an odd tail byte could not be coded
+    ${valgrind} ${bin} -n ${n_data} -m ${n_coding} -p foo -c ${extraopts} ${vflag} 2> foo.err
+    test $? -ne 0
+    checkfail "coding of an odd size"
+    grep -q "not a multiple of the word size" foo.err
+    checkfail "odd size not reported"
+
+    for i in `seq 0 $(expr ${n_data} - 1)`
+    do
+        head -c 100000 foo.d${i} > foo.tmp
+        mv foo.tmp foo.d${i}
+    done
+    ${valgrind} ${bin} -n ${n_data} -m ${n_coding} -p foo -c ${extraopts} ${vflag}
+    checkfail "coding generation"
+
+    head -c 99999 foo.d0 > foo.obj
+    rm foo.d0
+
+    ${valgrind} ${bin} -n ${n_data} -m ${n_coding} -p foo -R 0 -o 0 -l 99999 ${extraopts} ${vflag} > foo.out
+    checkfail "degraded read"
+    cmp foo.obj foo.out
+    checkfail "range mismatch"
+
+    head -c 99998 foo.d1 > foo.tmp
+    mv foo.tmp foo.d1
+    ${valgrind} ${bin} -n ${n_data} -m ${n_coding} -p foo -R 0 -o 0 -l 100 ${extraopts} ${vflag} > foo.out 2> foo.err
+    test $? -ne 0
+    checkfail "read with a truncated fragment"
+    grep -q "bad size" foo.err
+    checkfail "truncated fragment not reported"
+}
+
+# encode several objects listed in a manifest with -B, one of them being
+# missing, then lose fragments of the others and repair them in a batch
+do_batch_test()
+{
+    bin=$1
+    n_data=$2
+    n_coding=$3
+    n_objs=$4
+    shift 4
+    extraopts=$*
+    echo ${bin} n=${n_data} m=${n_coding} batch objects=${n_objs} ${extraopts}
+
+    rm -f foo.*
+
+    for o in `seq 1 ${n_objs}`
+    do
+        for i in `seq 0 $(expr ${n_data} - 1)`
+        do
+            head -c $(expr ${o} \* 100000) /dev/urandom > foo.o${o}.d${i}
+        done
+        echo foo.o${o} >> foo.list
+    done
+    # an object without data in the middle of the list
+    sed -i 2ifoo.none foo.list
+
+    ${valgrind} ${bin} -n ${n_data} -m ${n_coding} -B foo.list -c ${extraopts} ${vflag} 2> foo.out
+    test $? -ne 0
+    checkfail "missing object not reported"
+    grep -q "^foo.none: failed$" foo.out
+    checkfail "missing object report"
+    test `grep -c ": failed$" foo.out` -eq 1
+    checkfail "objects failed"
+
+    md5sum foo.o*.d* foo.o*.c? > foo.md5sum
+    for o in `seq 1 ${n_objs}`
+    do
+        rm foo.o${o}.d$(expr ${o} % ${n_data}) foo.o${o}.c0
+    done
+
+    grep -v foo.none foo.list | ${valgrind} ${bin} -n ${n_data} -m ${n_coding} -B - -r ${extraopts} ${vflag}
+    checkfail "batch repairing"
+
+    md5sum -c --quiet foo.md5sum
+    checkfail "fragments mismatch"
+}
+
+# split an object with -S, lose some fragments and stream it back with -J
+# encode with local parities, remove fragments and check that the repair
+# reads only the local groups when it can, with or without sidecars
+do_lrc_test()
+{
+    bin=$1
+    n_data=$2
+    n_coding=$3
+    n_local=$4
+    loss=$5
+    n_read=$6
+    shift 6
+    extraopts=$*
+    echo ${bin} n=${n_data} m=${n_coding} l=${n_local} loss=\"${loss}\" n_read=${n_read} ${extraopts}
+
+    for sidecars in yes no
+    do
+        rm -f foo.*
+
+        for i in `seq 0 $(expr ${n_data} - 1)`
+        do
+            head -c ${data_size:-1048576} /dev/urandom > foo.d${i}
+        done
+
+        ${valgrind} ${bin} -n ${n_data} -m ${n_coding} -L ${n_local} -p foo -c ${extraopts} ${vflag}
+        checkfail "coding generation"
+
+        md5sum `ls foo.d* foo.c* | grep -v crc` > foo.md5sum
+        if [ ${sidecars} = no ]
+        then
+            rm foo.*.crc
+        fi
+
+        for f in ${loss}
+        do
+            rm foo.${f}
+        done
+
+        ${valgrind} ${bin} -n ${n_data} -m ${n_coding} -L ${n_local} -p foo -r -v ${extraopts} 2> foo.out > /dev/null
+        checkfail "repairing"
+
+        if [ ${n_read} -gt 0 ]
+        then
+            grep -q "repairing from local groups of ${n_read} fragments" foo.out
+        else
+            ! grep -q "local groups" foo.out
+        fi
+        checkfail "repair plan"
+
+        md5sum -c --quiet foo.md5sum
+        checkfail "fragments mismatch"
+    done
+}
+
+# sparse data files: the blocks of zeros across the data files are not
+# multiplied and stay holes in the coding files and in the repaired ones
+do_sparse_test()
+{
+    bin=$1
+    n_data=$2
+    n_coding=$3
+    loss=$4
+    shift 4
+    extraopts=$*
+    echo ${bin} n=${n_data} m=${n_coding} sparse loss=\"${loss}\" ${extraopts}
+
+    rm -f foo.*
+
+    # 8 blocks of 1 MB, data in blocks 2 and 5 only
+    for i in `seq 0 $(expr ${n_data} - 1)`
+    do
+        truncate -s 8388608 foo.d${i}
+        head -c 1048576 /dev/urandom | dd of=foo.d${i} bs=1048576 seek=$(expr 2 + 3 \* $(expr ${i} % 2)) conv=notrunc 2> /dev/null
+    done
+
+    ${valgrind} ${bin} -n ${n_data} -m ${n_coding} -p foo -c -v ${extraopts} 2> foo.out > /dev/null
+    checkfail "coding generation"
+    grep -q "6 blocks of zeros skipped" foo.out
+    checkfail "zero blocks"
+
+    for i in `seq 0 $(expr ${n_coding} - 1)`
+    do
+        [ `stat -c %s foo.c${i}` -eq 8388608 -a `du -k foo.c${i} | cut -f1` -lt 3072 ]
+        checkfail "sparse coding file"
+    done
+
+    md5sum `ls foo.d* foo.c* | grep -v crc` > foo.md5sum
+
+    for f in ${loss}
+    do
+        rm foo.${f}
+    done
+
+    ${valgrind} ${bin} -n ${n_data} -m ${n_coding} -p foo -r ${extraopts} ${vflag}
+    checkfail "repairing"
+
+    md5sum -c --quiet foo.md5sum
+    checkfail "fragments mismatch"
+
+    for f in ${loss}
+    do
+        [ `du -k foo.${f} | cut -f1` -lt 3072 ]
+        checkfail "sparse repaired file"
+    done
+
+    ${valgrind} ${bin} -n ${n_data} -m ${n_coding} -p foo -V ${extraopts} ${vflag}
+    checkfail "verifying"
+}
+
+# run a daemon and encode, repair and verify objects through it
+do_daemon_test()
+{
+    bin=$1
+    n_data=$2
+    n_coding=$3
+    n_objects=$4
+    shift 4
+    extraopts=$*
+    echo ${bin} n=${n_data} m=${n_coding} daemon objects=${n_objects} ${extraopts}
+
+    rm -f foo.*
+
+    ${valgrind} ${bin} -n ${n_data} -m ${n_coding} -Z foo.sock ${extraopts} ${vflag} &
+    pid=$!
+    for i in `seq 50`
+    do
+        test -S foo.sock && break
+        sleep 0.1
+    done
+    test -S foo.sock
+    checkfail "starting the daemon"
+    test `stat -c %a foo.sock` = 600
+    checkfail "socket permissions"
+
+    for o in `seq ${n_objects}`
+    do
+        for i in `seq 0 $(expr ${n_data} - 1)`
+        do
+            head -c ${data_size:-100000} /dev/urandom > foo.${o}.d${i}
+        done
+        ${bin} -z foo.sock -p foo.${o} -c
+        checkfail "encoding through the daemon"
+    done
+
+    md5sum `ls foo.*.d* foo.*.c* | grep -v crc` > foo.md5sum
+    for o in `seq ${n_objects}`
+    do
+        rm foo.${o}.d$(expr ${o} % ${n_data}) foo.${o}.c0
+        ${bin} -z foo.sock -p foo.${o} -r
+        checkfail "repairing through the daemon"
+    done
+    md5sum -c --quiet foo.md5sum
+    checkfail "fragments mismatch"
+
+    # a request failing takes its worker down, the next ones go on
+    ${bin} -z foo.sock -p foo.none -c 2> /dev/null
+    test $? -ne 0
+    checkfail "failure not reported"
+
+    # prefixes escaping the client's directory are refused
+    for p in `pwd`/foo.1 ../foo.1 foo/../foo.1
+    do
+        ${bin} -z foo.sock -p ${p} -V 2> /dev/null
+        test $? -ne 0
+        checkfail "prefix ${p} accepted"
+    done
+    for o in `seq ${n_objects}`
+    do
+        ${bin} -z foo.sock -p foo.${o} -V
+        checkfail "verifying through the daemon"
+    done
+
+    kill ${pid}
+    wait ${pid} 2> /dev/null
+}
+
+do_stream_test()
+{
+    bin=$1
+    n_data=$2
+    n_coding=$3
+    cell=$4
+    size=$5
+    data_loss=$6
+    coding_loss=$7
+    shift 7
+    extraopts=$*
+    echo ${bin} n=${n_data} m=${n_coding} stream cell=${cell} size=${size} data_loss=\"${data_loss}\" coding_loss=\"${coding_loss}\" ${extraopts}
+
+    rm -f foo.*
+
+    head -c ${size} /dev/urandom > foo.obj
+    cat foo.obj | ${valgrind} ${bin} -n ${n_data} -m ${n_coding} -p foo -S - -b ${cell} ${extraopts} ${vflag}
+    checkfail "splitting"
+
+    for i in $data_loss
+    do
+        rm foo.d${i}
+    done
+
+    for i in $coding_loss
+    do
+        rm foo.c${i}
+    done
+
+    ${valgrind} ${bin} -n ${n_data} -m ${n_coding} -p foo -J -b ${cell} ${extraopts} ${vflag} > foo.out
+    checkfail "joining"
+
+    cmp foo.obj foo.out
+    checkfail "object mismatch"
+}
+
 ./ecgf4 -u
 ./ecgf8 -u
 ./ecgf16 -u
@@ -93,3 +685,68 @@ do_test ./ecgf16 9 5 "1 3 5 7 8" "" $*
 
 do_test ./ecgf8 9 5 "" "0 1 2 3 4" $*
 do_test ./ecgf16 9 5 "" "0 1 2 3 4" $*
+
+do_test ./ecgf8 5 3 "0 2 4" "" $*
+do_test ./ecgf16 5 3 "0 2 4" "" $*
+
+do_test ./ecgf8 9 5 "1 3 5" "1 3" -s -X $*
+do_test ./ecgf16 5 3 "0 2 4" "" -s -X $*
+
+# wide stripes, beyond the generated matrices
+data_size=4096 do_test ./ecgf16 300 8 "0 100 299" "3" $*
+data_size=4096 do_test ./ecgf16 300 8 "7 8 9 10 11 12 13" "" -s $*
+
+do_test ./ecgf8 9 3 "1 2" "2" -D -j 2 $*
+
+do_test ./ecgf8 9 3 "1 2" "2" -P $*
+data_size=3000000 do_test ./ecgf16 9 5 "1 3 5" "1 3" -s -P $*
+data_size=3000002 do_test ./ecgf8 4 2 "0" "1" -P -D $*
+do_test ./ecgf16 5 3 "0 2 4" "" -D $*
+# not a multiple of the block nor of the direct i/o alignment
+data_size=3000002 do_test ./ecgf8 9 5 "1 3 5" "1 3" -D -j 2 $*
+data_size=3000002 do_test ./ecgf16 5 3 "0 2" "1" -D $*
+
+do_loss_test ./ecgf8 4 2 "d0 d1 c0" $*
+do_dcache_corrupt_test ./ecgf8 $*
+do_loss_test ./ecgf16 5 3 "d1 c0 c1 c2" -P $*
+
+do_update_test ./ecgf8 9 5 3 4096 1000 $*
+do_update_test ./ecgf16 9 5 0 1048000 576 $*
+do_update_test ./ecgf16 4 3 3 0 4096 $*
+
+do_verify_test ./ecgf8 9 3 1 12345 $*
+do_verify_test ./ecgf16 5 3 2 1048574 -s -X $*
+data_size=3000002 do_verify_test ./ecgf8 4 2 0 2999999 -D -j 2 $*
+missing=c0 data_size=3000000 do_verify_test ./ecgf8 4 2 1 12345 -s -X $*
+missing=c2 do_verify_test ./ecgf16 5 3 0 1000 -X $*
+
+data_size=3000000 do_corrupt_test ./ecgf8 9 3 "d1 c2" 2500000 "d4" $*
+do_corrupt_test ./ecgf16 5 3 "d0 d2 c0" 1000 "" -s -X $*
+data_size=3000002 do_corrupt_test ./ecgf8 4 2 "d3" 2999999 "c1" -D -j 2 $*
+
+do_range_test ./ecgf8 9 3 2 1000 4096 "d2 d5 c0" $*
+do_range_test ./ecgf16 5 3 0 1048000 10000 "d0 d1 d4" $*
+data_size=3000001 do_range_test ./ecgf8 4 2 1 2999990 100 "d1" -s -X $*
+do_range_test ./ecgf16 5 3 4 40000 70001 "d4 c1" -s -X $*
+do_range_size_test ./ecgf16 4 2 $*
+
+do_batch_test ./ecgf8 4 2 7 -j 3 $*
+do_batch_test ./ecgf16 5 3 3 $*
+
+do_lrc_test ./ecgf8 12 4 3 "d5" 4 $*
+do_lrc_test ./ecgf8 12 4 3 "d0 d9 c5" 12 -j 2 $*
+do_lrc_test ./ecgf16 12 2 4 "d0 d1 c2" 0 $*
+do_lrc_test ./ecgf8 9 3 3 "d7 d8 c5" 0 -s -X $*
+data_size=3000000 do_lrc_test ./ecgf8 12 4 3 "d5 c6" 8 -P $*
+
+do_daemon_test ./ecgf8 4 2 5 -j 2 $*
+do_daemon_test ./ecgf16 5 3 3 $*
+
+do_stream_test ./ecgf8 9 3 4096 3000000 "" "" $*
+do_stream_test ./ecgf8 9 3 4096 3000000 "1 4" "0" $*
+do_stream_test ./ecgf16 4 2 512 36864 "0 3" "" $*
+do_stream_test ./ecgf16 4 2 512 0 "2" "1" $*
+
+do_sparse_test ./ecgf8 4 2 "d1 c0" $*
+do_sparse_test ./ecgf16 5 3 "d0 d3 c2" -X $*
+do_sparse_test ./ecgf8 4 2 "d0 c1" -P $*
@@ -3,7 +3,7 @@
 
 void vec_zero(t_vec *vec)
 {
-  memset(vec->mem, 0, sizeof (int) * vec->n);
+  memset(vec->mem, 0, sizeof (t_gf_elt) * vec->n);
 }
 
 t_vec *vec_xcalloc(u_int n)
@@ -12,7 +12,7 @@ t_vec *vec_xcalloc(u_int n)
 
   vec = xmalloc(sizeof (*vec));
   vec->n = n;
-  vec->mem = xmalloc(sizeof (int) * n);
+  vec->mem = xmalloc(sizeof (t_gf_elt) * n);
   vec_zero(vec);
   return vec;
 }
@@ -2,7 +2,7 @@
 typedef struct s_vec
 {
   u_int n;
-  int *mem;
+  t_gf_elt *mem;
 #define VEC_ITEM(vec, i) ((vec)->mem[(i)])
 } t_vec;
 